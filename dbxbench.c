@@ -0,0 +1,290 @@
+/*
+    UnDBX - Tool to extract e-mail messages from Outlook Express DBX files.
+    Copyright (C) 2008-2015 Avi Rozen <avi.rozen@gmail.com>
+
+    DBX file format parsing code is based on DbxConv - a DBX to MBOX
+    Converter.  Copyright (C) 2008, 2009 Ulrich Krebs
+    <ukrebs@freenet.de>
+
+    RFC-2822 and RFC-2047 parsing code is adapted from GNU Mailutils -
+    a suite of utilities for electronic mail, Copyright (C) 2002,
+    2003, 2004, 2005, 2006, 2009, 2010 Free Software Foundation, Inc.
+
+    This file is part of UnDBX.
+
+    UnDBX is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  dbxbench - time the phases of extracting a DBX file with UnDBX:
+  opening the file (index and info records), full extraction, a no-op
+  run, a sync run after the DBX file was touched, and safe mode.
+
+  Given a list of the message chains in the DBX file, as written by
+  dbxgen --truth, it benchmarks recovery instead: the scan, how many of
+  the chains it reconstructed exactly, and a full recovery run.
+*/
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include "dbxread.h"
+
+#define BENCH_OPEN_REPEAT 5
+
+typedef struct {
+  long long int offset;
+  int deleted;
+  unsigned int first;
+  unsigned int last;
+  int count;
+} bench_chain_t;
+
+static double _bench_now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+static void _bench_report(char *phase, double seconds, unsigned long long int size)
+{
+  printf("%-10s %10.3f s", phase, seconds);
+  if (size > 0 && seconds > 0)
+    printf(" %10.1f MB/s", size / seconds / 1e6);
+  printf("\n");
+  fflush(stdout);
+}
+
+/* run undbx quietly, and return its wall time */
+static double _bench_run(char *undbx, char *options, char *dbx_file, char *out_dir)
+{
+  char *command = NULL;
+  double start = 0;
+  int rc = 0;
+
+  command = (char *)malloc(strlen(undbx) + strlen(options) + strlen(dbx_file) + strlen(out_dir) + 32);
+  if (command == NULL) {
+    perror("dbxbench (malloc)");
+    exit(EXIT_FAILURE);
+  }
+  sprintf(command, "\"%s\" -v 0 %s \"%s\" \"%s\" >%s", undbx, options, dbx_file, out_dir,
+#ifdef _WIN32
+          "NUL"
+#else
+          "/dev/null"
+#endif
+          );
+
+  start = _bench_now();
+  rc = system(command);
+  if (rc != 0) {
+    fprintf(stderr, "dbxbench: %s failed\n", command);
+    exit(EXIT_FAILURE);
+  }
+  free(command);
+
+  return _bench_now() - start;
+}
+
+static int _bench_chain_cmp(const bench_chain_t *a, const bench_chain_t *b)
+{
+  if (a->offset != b->offset)
+    return (a->offset < b->offset)? -1 : 1;
+  if (a->deleted != b->deleted)
+    return a->deleted - b->deleted;
+  if (a->first != b->first)
+    return (a->first < b->first)? -1 : 1;
+  return 0;
+}
+
+static bench_chain_t *_bench_load_truth(char *filename, int *count)
+{
+  bench_chain_t *truth = NULL;
+  bench_chain_t chain;
+  int capacity = 0;
+  char line[256];
+  FILE *file = fopen(filename, "r");
+
+  if (file == NULL) {
+    perror("dbxbench (fopen)");
+    exit(EXIT_FAILURE);
+  }
+
+  *count = 0;
+  while (fgets(line, sizeof(line), file)) {
+    if (line[0] == '#')
+      continue;
+    if (sscanf(line, "%lld %d %u %u %d",
+               &chain.offset, &chain.deleted, &chain.first, &chain.last, &chain.count) != 5) {
+      fprintf(stderr, "dbxbench: bad line in %s: %s", filename, line);
+      exit(EXIT_FAILURE);
+    }
+    if (*count == capacity) {
+      capacity = capacity? 2 * capacity : 1024;
+      truth = (bench_chain_t *)realloc(truth, capacity * sizeof(bench_chain_t));
+      if (truth == NULL) {
+        perror("dbxbench (realloc)");
+        exit(EXIT_FAILURE);
+      }
+    }
+    truth[(*count)++] = chain;
+  }
+  fclose(file);
+
+  qsort(truth, *count, sizeof(bench_chain_t), (int (*)(const void *, const void *))_bench_chain_cmp);
+  return truth;
+}
+
+/* time the recovery scan, and compare the chains it found with the
+   expected ones: a chain is reconstructed if its first and last
+   fragments and its length match */
+static void _bench_recover(char *undbx, char *dbx_file, char *work_dir, char *truth_file)
+{
+  dbx_options_t options = { 0 };
+  bench_chain_t *truth = NULL;
+  char *recover_dir = NULL;
+  unsigned long long int size = sys_filesize(NULL, dbx_file);
+  int truth_count = 0;
+  int found = 0;
+  int exact = 0;
+  double start = 0;
+  double seconds = 0;
+  dbx_t *dbx = NULL;
+  int j = 0;
+  int k = 0;
+
+  truth = _bench_load_truth(truth_file, &truth_count);
+
+  options.verbosity = DBX_VERBOSITY_QUIET;
+  options.jobs = 1;
+  options.threads = 1;
+  options.recover = 1;
+
+  start = _bench_now();
+  dbx = dbx_open(dbx_file, &options);
+  seconds = _bench_now() - start;
+  if (dbx == NULL) {
+    fprintf(stderr, "dbxbench: can't open %s\n", dbx_file);
+    exit(EXIT_FAILURE);
+  }
+
+  for (j = 0; j < dbx->scan_count; j++) {
+    dbx_chains_t *chains = dbx->scan[j];
+    for (k = 0; k < chains->count; k++) {
+      bench_chain_t chain;
+      bench_chain_t *expected = NULL;
+      dbx_fragment_t *fragment = chains->chains[k];
+
+      while (fragment->next >= 0)
+        fragment = chains->fragments + fragment->next;
+      chain.offset = chains->offset;
+      chain.deleted = chains->deleted;
+      chain.first = chains->chains[k]->offset;
+      chain.last = fragment->offset;
+      chain.count = chains->chain_fragment_count[k];
+      found++;
+
+      expected = (bench_chain_t *)bsearch(&chain, truth, truth_count, sizeof(bench_chain_t),
+                                          (int (*)(const void *, const void *))_bench_chain_cmp);
+      if (expected && expected->last == chain.last && expected->count == chain.count)
+        exact++;
+    }
+  }
+  dbx_close(dbx);
+
+  printf("%s: %d chains, %llu bytes\n", dbx_file, truth_count, size);
+  _bench_report("scan", seconds, size);
+  printf("%-10s %10d expected %8d found %8d exact (%.2f%%)\n", "chains",
+         truth_count, found, exact, truth_count? 100.0 * exact / truth_count : 100.0);
+  fflush(stdout);
+
+  recover_dir = sys_path(work_dir, "recover");
+  sys_mkdir(work_dir, "recover");
+  _bench_report("recover", _bench_run(undbx, "-r", dbx_file, recover_dir), size);
+
+  free(recover_dir);
+  free(truth);
+}
+
+int main(int argc, char *argv[])
+{
+  dbx_options_t options = { 0 };
+  char *undbx = NULL;
+  char *dbx_file = NULL;
+  char *full_dir = NULL;
+  char *safe_dir = NULL;
+  unsigned long long int size = 0;
+  int count = 0;
+  double start = 0;
+  int i = 0;
+
+  if (argc != 4 && argc != 5) {
+    fprintf(stderr, "Usage: %s <UNDBX> <DBX-FILE> <WORK-FOLDER> [<TRUTH-FILE>]\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  if (argc == 5) {
+    _bench_recover(argv[1], argv[2], argv[3], argv[4]);
+    return EXIT_SUCCESS;
+  }
+
+  undbx = argv[1];
+  dbx_file = argv[2];
+  full_dir = sys_path(argv[3], "full");
+  safe_dir = sys_path(argv[3], "safe");
+  size = sys_filesize(NULL, dbx_file);
+
+  options.verbosity = DBX_VERBOSITY_QUIET;
+  options.jobs = 1;
+  options.threads = 1;
+
+  /* reading the index and info records, without the messages */
+  start = _bench_now();
+  for (i = 0; i < BENCH_OPEN_REPEAT; i++) {
+    dbx_t *dbx = dbx_open(dbx_file, &options);
+    if (dbx == NULL || dbx->type != DBX_TYPE_EMAIL) {
+      fprintf(stderr, "dbxbench: can't open %s\n", dbx_file);
+      exit(EXIT_FAILURE);
+    }
+    count = dbx->message_count;
+    dbx_close(dbx);
+  }
+
+  printf("%s: %d messages, %llu bytes\n", dbx_file, count, size);
+  _bench_report("open", (_bench_now() - start) / BENCH_OPEN_REPEAT, 0);
+
+  sys_mkdir(argv[3], "full");
+  sys_mkdir(argv[3], "safe");
+
+  _bench_report("extract", _bench_run(undbx, "", dbx_file, full_dir), size);
+  _bench_report("no-op", _bench_run(undbx, "", dbx_file, full_dir), 0);
+
+  /* a newer modification time forces a sync against the output folder */
+  sys_set_time(dbx_file, time(NULL) + 1);
+  _bench_report("sync", _bench_run(undbx, "", dbx_file, full_dir), 0);
+
+  _bench_report("safe-mode", _bench_run(undbx, "-s", dbx_file, safe_dir), size);
+
+  free(safe_dir);
+  free(full_dir);
+
+  return EXIT_SUCCESS;
+}
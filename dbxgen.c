@@ -0,0 +1,736 @@
+/*
+    UnDBX - Tool to extract e-mail messages from Outlook Express DBX files.
+    Copyright (C) 2008-2015 Avi Rozen <avi.rozen@gmail.com>
+
+    DBX file format parsing code is based on DbxConv - a DBX to MBOX
+    Converter.  Copyright (C) 2008, 2009 Ulrich Krebs
+    <ukrebs@freenet.de>
+
+    RFC-2822 and RFC-2047 parsing code is adapted from GNU Mailutils -
+    a suite of utilities for electronic mail, Copyright (C) 2002,
+    2003, 2004, 2005, 2006, 2009, 2010 Free Software Foundation, Inc.
+
+    This file is part of UnDBX.
+
+    UnDBX is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  dbxgen - write synthetic DBX files, for benchmarking UnDBX.
+
+  Messages are made of random text, and are laid out the way Outlook
+  Express lays them out: 0x200 byte blocks, followed by the message
+  info records and the index tree. Blocks of different messages are
+  interleaved to the requested degree of fragmentation.
+
+  For benchmarking recovery, some messages can be written as deleted
+  fragment chains, or with offsets relative to a different base (as
+  left behind by an earlier copy of the file), garbage can be put
+  between blocks, and the whole image can be shifted. Deleted and
+  shifted messages are left out of the index, and a list of the chains
+  that recovery is expected to find can be written to a file.
+*/
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+
+#define DBX_HEADER_SIZE  0x24BC
+#define DBX_BLOCK_SIZE   0x210
+#define DBX_BLOCK_DATA   0x200
+#define DBX_MAX_FANOUT   127
+#define DBX_FILETIME     0x01C0000000000000ULL
+#define DBX_MAX_GARBAGE  0x400
+#define DBX_SHIFT_STEP   0x400
+
+typedef unsigned long long int u64;
+
+typedef struct {
+  int message;
+  int part;
+  unsigned int offset;
+  unsigned int garbage;
+} gen_block_t;
+
+/* first_block is the index of the message's first block in block_index,
+   shift is added to the offsets stored in the message's blocks */
+typedef struct {
+  unsigned int size;
+  unsigned int first_block;
+  int deleted;
+  int shift;
+  unsigned int info_offset;
+  unsigned int info_size;
+} gen_message_t;
+
+typedef struct {
+  unsigned int offset;
+  unsigned int child;
+  unsigned int child_count;
+  int first;
+  int count;
+  unsigned int *children;
+  unsigned int *child_counts;
+} gen_node_t;
+
+typedef struct {
+  int messages;
+  unsigned int min_size;
+  unsigned int max_size;
+  int fanout;
+  double fragmentation;
+  double deleted;
+  double shifted;
+  double garbage;
+  unsigned int base;
+  int latin1;
+  u64 seed;
+  gen_message_t *message;
+  int *live;
+  int live_count;
+  unsigned int *block_index;
+  gen_block_t *blocks;
+  int block_count;
+  gen_node_t *nodes;
+  int node_count;
+  int node_capacity;
+  int depth;
+  unsigned int root;
+  unsigned int size;
+} gen_t;
+
+/* xorshift64* */
+static u64 _gen_random(u64 *state)
+{
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 2685821657736338717ULL;
+}
+
+static double _gen_uniform(u64 *state)
+{
+  return (_gen_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void _gen_put_int(unsigned char *p, unsigned int value)
+{
+  p[0] = value & 0xFF;
+  p[1] = (value >> 8) & 0xFF;
+  p[2] = (value >> 16) & 0xFF;
+  p[3] = (value >> 24) & 0xFF;
+}
+
+static void _gen_put_long_long(unsigned char *p, u64 value)
+{
+  _gen_put_int(p, (unsigned int)value);
+  _gen_put_int(p + 4, (unsigned int)(value >> 32));
+}
+
+/* message header fields, also stored in the info record */
+static void _gen_fields(gen_t *gen, int m, char fields[6][64])
+{
+  /* 8-bit subjects, as written by a Western European Outlook Express */
+  sprintf(fields[0], gen->latin1? "Benchmark message %d caf\xE9" : "Benchmark message %d", m);
+  sprintf(fields[1], "Sender %d", m);
+  sprintf(fields[2], "s%d@example.org", m);
+  sprintf(fields[3], "Recipient %d", m % 97);
+  sprintf(fields[4], "r%d@example.org", m % 97);
+  sprintf(fields[5], "<%d@example.org>", m);
+}
+
+/* the message body is generated on demand, from a per message seed */
+static void _gen_body(gen_t *gen, int m, unsigned char *body)
+{
+  char fields[6][64];
+  unsigned int size = gen->message[m].size;
+  u64 state = (gen->seed + 1) * 0x9E3779B97F4A7C15ULL + m + 1;
+  unsigned int n = 0;
+  unsigned int i = 0;
+  char header[512];
+
+  _gen_fields(gen, m, fields);
+  n = sprintf(header,
+              "From: \"%s\" <%s>\r\n"
+              "To: \"%s\" <%s>\r\n"
+              "Subject: %s\r\n"
+              "Message-ID: %s\r\n"
+              "Date: Mon, 1 Jan 2001 %02d:%02d:%02d +0000\r\n"
+              "\r\n",
+              fields[1], fields[2], fields[3], fields[4], fields[0], fields[5],
+              (m / 3600) % 24, (m / 60) % 60, m % 60);
+  if (n > size)
+    n = size;
+  memcpy(body, header, n);
+
+  for (i = n; i < size; i++) {
+    if ((i - n) % 78 == 76)
+      body[i] = '\r';
+    else if ((i - n) % 78 == 77)
+      body[i] = '\n';
+    else
+      body[i] = 32 + _gen_random(&state) % 95;
+  }
+}
+
+static unsigned int _gen_header_size(gen_t *gen, int m)
+{
+  char fields[6][64];
+  _gen_fields(gen, m, fields);
+  return strlen(fields[0]) + strlen(fields[1]) + strlen(fields[2]) +
+    strlen(fields[3]) + strlen(fields[4]) + strlen(fields[5]) +
+    sizeof("From: \"\" <>\r\nTo: \"\" <>\r\nSubject: \r\nMessage-ID: \r\n"
+           "Date: Mon, 1 Jan 2001 00:00:00 +0000\r\n\r\n") - 1;
+}
+
+static gen_block_t *_gen_block(gen_t *gen, int m, int part)
+{
+  return gen->blocks + gen->block_index[gen->message[m].first_block + part];
+}
+
+/* info record: 12 byte header, descriptors, then indirect values */
+static unsigned int _gen_info(gen_t *gen, int m, unsigned int offset, unsigned char *record)
+{
+  char fields[6][64];
+  static const int types[6] = { 0x08, 0x0D, 0x0E, 0x13, 0x14, 0x07 };
+  unsigned char data[512];
+  unsigned int descriptors[16];
+  unsigned int block = 0;
+  unsigned int length = 0;
+  int count = 0;
+  int i = 0;
+
+  _gen_fields(gen, m, fields);
+  block = _gen_block(gen, m, 0)->offset;
+
+  descriptors[count++] = 0x80 | (m << 8);
+  descriptors[count++] = 0x81 | (0x21 << 8);
+  descriptors[count++] = 0x02 | (length << 8);
+  _gen_put_long_long(data + length, DBX_FILETIME + (u64)m * 10000000ULL);
+  length += 8;
+  descriptors[count++] = 0x12 | (length << 8);
+  _gen_put_long_long(data + length, DBX_FILETIME + (u64)m * 10000000ULL + 600000000ULL);
+  length += 8;
+  for (i = 0; i < 6; i++) {
+    descriptors[count++] = types[i] | (length << 8);
+    strcpy((char *)data + length, fields[i]);
+    length += strlen(fields[i]) + 1;
+  }
+  /* the message offset is stored directly if it fits in 24 bits */
+  if (block < 0x1000000) {
+    descriptors[count++] = 0x84 | (block << 8);
+  }
+  else {
+    descriptors[count++] = 0x04 | (length << 8);
+    _gen_put_int(data + length, block);
+    length += 4;
+  }
+  descriptors[count++] = 0x11 | (length << 8);
+  _gen_put_int(data + length, gen->message[m].size);
+  length += 4;
+
+  if (record) {
+    _gen_put_int(record, offset);
+    _gen_put_int(record + 4, 4 * count + length);
+    _gen_put_int(record + 8, count << 16);
+    for (i = 0; i < count; i++)
+      _gen_put_int(record + 12 + 4 * i, descriptors[i]);
+    memcpy(record + 12 + 4 * count, data, length);
+  }
+
+  return 12 + 4 * count + length;
+}
+
+static gen_node_t *_gen_node(gen_t *gen)
+{
+  if (gen->node_count == gen->node_capacity) {
+    gen->node_capacity = gen->node_capacity? 2 * gen->node_capacity : 64;
+    gen->nodes = (gen_node_t *)realloc(gen->nodes, gen->node_capacity * sizeof(gen_node_t));
+    if (gen->nodes == NULL) {
+      perror("dbxgen (realloc)");
+      exit(EXIT_FAILURE);
+    }
+  }
+  memset(gen->nodes + gen->node_count, 0, sizeof(gen_node_t));
+  return gen->nodes + gen->node_count++;
+}
+
+/* a node holds up to fanout messages, with subtrees before, between
+   and after them: nodes are allocated after their children */
+static unsigned int _gen_tree(gen_t *gen, int first, int count, int depth, unsigned int *offset)
+{
+  gen_node_t *node = NULL;
+  unsigned int child = 0;
+  unsigned int child_count = 0;
+  unsigned int *children = NULL;
+  unsigned int *child_counts = NULL;
+  int entries = 0;
+  int i = 0;
+
+  if (count <= 0)
+    return 0;
+
+  if (depth > gen->depth)
+    gen->depth = depth;
+
+  entries = (count <= gen->fanout)? count : gen->fanout;
+  children = (unsigned int *)calloc(entries, sizeof(unsigned int));
+  child_counts = (unsigned int *)calloc(entries, sizeof(unsigned int));
+  if (children == NULL || child_counts == NULL) {
+    perror("dbxgen (calloc)");
+    exit(EXIT_FAILURE);
+  }
+
+  if (count > gen->fanout) {
+    int step = (count - entries) / (entries + 1);
+    int pos = first + step;
+    child = _gen_tree(gen, first, step, depth + 1, offset);
+    child_count = step;
+    for (i = 0; i < entries; i++) {
+      int n = (i == entries - 1)? first + count - (pos + 1) : step;
+      children[i] = _gen_tree(gen, pos + 1, n, depth + 1, offset);
+      child_counts[i] = n;
+      pos += 1 + n;
+    }
+  }
+
+  node = _gen_node(gen);
+  node->offset = *offset;
+  node->child = child;
+  node->child_count = child_count;
+  node->first = first;
+  node->count = entries;
+  node->children = children;
+  node->child_counts = child_counts;
+  *offset += 24 + 12 * entries;
+
+  return node->offset;
+}
+
+/* entry i of a node is live message first + i + (messages in the subtrees before it) */
+static int _gen_entry(gen_t *gen, gen_node_t *node, int i)
+{
+  int m = node->first + node->child_count;
+  int k = 0;
+  for (k = 0; k < i; k++)
+    m += 1 + node->child_counts[k];
+  return gen->live[m];
+}
+
+/* offset of a block as stored in the file, or 0 for no block */
+static unsigned int _gen_stored(gen_t *gen, int m, int part)
+{
+  if (part < 0 || part * DBX_BLOCK_DATA >= gen->message[m].size)
+    return 0;
+  return _gen_block(gen, m, part)->offset + gen->message[m].shift;
+}
+
+static void _gen_layout(gen_t *gen)
+{
+  u64 state = gen->seed * 0x2545F4914F6CDD1DULL + 1;
+  unsigned int offset = DBX_HEADER_SIZE;
+  double lmin = log((double)gen->min_size);
+  double lmax = log((double)gen->max_size);
+  int m = 0;
+  int b = 0;
+
+  gen->message = (gen_message_t *)calloc(gen->messages + 1, sizeof(gen_message_t));
+  gen->live = (int *)calloc(gen->messages + 1, sizeof(int));
+  if (gen->message == NULL || gen->live == NULL) {
+    perror("dbxgen (calloc)");
+    exit(EXIT_FAILURE);
+  }
+
+  /* sizes are distributed log-uniformly */
+  for (m = 0; m < gen->messages; m++) {
+    unsigned int size = (unsigned int)exp(lmin + (lmax - lmin) * _gen_uniform(&state));
+    unsigned int header = _gen_header_size(gen, m);
+    gen->message[m].size = (size < header)? header : size;
+    gen->block_count += (gen->message[m].size + DBX_BLOCK_DATA - 1) / DBX_BLOCK_DATA;
+  }
+
+  /* deleted and shifted messages are not in the index */
+  for (m = 0; m < gen->messages; m++) {
+    gen->message[m].deleted = _gen_uniform(&state) < gen->deleted;
+    if (_gen_uniform(&state) < gen->shifted)
+      gen->message[m].shift = -(int)(1 + _gen_random(&state) % 4) * DBX_SHIFT_STEP;
+    if (!gen->message[m].deleted && !gen->message[m].shift)
+      gen->live[gen->live_count++] = m;
+  }
+
+  gen->blocks = (gen_block_t *)calloc(gen->block_count + 1, sizeof(gen_block_t));
+  if (gen->blocks == NULL) {
+    perror("dbxgen (calloc)");
+    exit(EXIT_FAILURE);
+  }
+  for (m = 0; m < gen->messages; m++) {
+    int part = 0;
+    unsigned int done = 0;
+    for (done = 0; done < gen->message[m].size; done += DBX_BLOCK_DATA) {
+      gen->blocks[b].message = m;
+      gen->blocks[b].part = part++;
+      b++;
+    }
+  }
+
+  /* fragmentation: a fraction of the blocks swap places at random */
+  for (b = 0; b < gen->block_count; b++) {
+    if (_gen_uniform(&state) < gen->fragmentation) {
+      int other = _gen_random(&state) % gen->block_count;
+      gen_block_t swap = gen->blocks[b];
+      gen->blocks[b] = gen->blocks[other];
+      gen->blocks[other] = swap;
+    }
+  }
+  for (b = 0; b < gen->block_count; b++) {
+    gen->blocks[b].offset = offset;
+    offset += DBX_BLOCK_SIZE;
+    if (_gen_uniform(&state) < gen->garbage) {
+      gen->blocks[b].garbage = 4 * (1 + _gen_random(&state) % (DBX_MAX_GARBAGE / 4));
+      offset += gen->blocks[b].garbage;
+    }
+  }
+
+  /* next pointers are found via a per message block index */
+  gen->block_index = (unsigned int *)calloc(gen->block_count + 1, sizeof(unsigned int));
+  if (gen->block_index == NULL) {
+    perror("dbxgen (calloc)");
+    exit(EXIT_FAILURE);
+  }
+  {
+    unsigned int *first = (unsigned int *)calloc(gen->messages + 1, sizeof(unsigned int));
+    if (first == NULL) {
+      perror("dbxgen (calloc)");
+      exit(EXIT_FAILURE);
+    }
+    for (m = 0, b = 0; m < gen->messages; m++) {
+      first[m] = b;
+      b += (gen->message[m].size + DBX_BLOCK_DATA - 1) / DBX_BLOCK_DATA;
+    }
+    for (b = 0; b < gen->block_count; b++)
+      gen->block_index[first[gen->blocks[b].message] + gen->blocks[b].part] = b;
+    for (m = 0; m < gen->messages; m++)
+      gen->message[m].first_block = first[m];
+    free(first);
+  }
+
+  for (b = 0; b < gen->live_count; b++) {
+    m = gen->live[b];
+    gen->message[m].info_offset = offset;
+    gen->message[m].info_size = _gen_info(gen, m, offset, NULL);
+    offset += (gen->message[m].info_size + 3) & ~3U;
+  }
+
+  gen->root = _gen_tree(gen, 0, gen->live_count, 1, &offset);
+  gen->size = gen->base + offset;
+}
+
+/* random bytes, with a header that is almost, but not quite, a
+   fragment header: recovery should skip it */
+static void _gen_garbage(u64 *state, unsigned char *buffer, unsigned int size)
+{
+  unsigned int i = 0;
+
+  for (i = 0; i < size; i++)
+    buffer[i] = _gen_random(state) & 0xFF;
+  if (size >= 16) {
+    _gen_put_int(buffer + 4, (buffer[0] & 1)? 0x200 : 0x1FC);
+    _gen_put_int(buffer + 8, 0x300);
+  }
+}
+
+static void _gen_write(gen_t *gen, FILE *file)
+{
+  u64 state = gen->seed * 0x9E3779B97F4A7C15ULL + 2;
+  unsigned char *buffer = NULL;
+  unsigned char *body = NULL;
+  int body_message = -1;
+  int b = 0;
+  int m = 0;
+  int n = 0;
+
+  buffer = (unsigned char *)calloc(1, DBX_HEADER_SIZE + 24 + 12 * DBX_MAX_FANOUT + 4096);
+  body = (unsigned char *)malloc(gen->max_size + 1024);
+  if (buffer == NULL || body == NULL) {
+    perror("dbxgen (malloc)");
+    exit(EXIT_FAILURE);
+  }
+
+  _gen_put_int(buffer, 0xFE12ADCF);
+  _gen_put_int(buffer + 4, 0x6F74FDC5);
+  _gen_put_int(buffer + 8, 0x11D1E366);
+  _gen_put_int(buffer + 12, 0xC0004E9A);
+  _gen_put_int(buffer + 0xC4, gen->live_count);
+  _gen_put_int(buffer + 0xE4, gen->root);
+  if (gen->base > 0) {
+    unsigned char *garbage = (unsigned char *)malloc(gen->base);
+    if (garbage == NULL) {
+      perror("dbxgen (malloc)");
+      exit(EXIT_FAILURE);
+    }
+    _gen_garbage(&state, garbage, gen->base);
+    fwrite(garbage, 1, gen->base, file);
+    free(garbage);
+  }
+  fwrite(buffer, 1, DBX_HEADER_SIZE, file);
+
+  for (b = 0; b < gen->block_count; b++) {
+    gen_block_t *block = gen->blocks + b;
+    gen_message_t *message = gen->message + block->message;
+    unsigned int start = block->part * DBX_BLOCK_DATA;
+    unsigned int size = message->size - start;
+
+    if (size > DBX_BLOCK_DATA)
+      size = DBX_BLOCK_DATA;
+
+    if (body_message != block->message) {
+      _gen_body(gen, block->message, body);
+      body_message = block->message;
+    }
+
+    memset(buffer, 0, DBX_BLOCK_SIZE);
+    _gen_put_int(buffer, _gen_stored(gen, block->message, block->part));
+    _gen_put_int(buffer + 12, _gen_stored(gen, block->message, block->part + 1));
+    memcpy(buffer + 16, body + start, size);
+    if (message->deleted) {
+      /* the previous block offset clobbers the first 4 data bytes */
+      _gen_put_int(buffer + 4, DBX_BLOCK_DATA - 4);
+      _gen_put_int(buffer + 8, DBX_BLOCK_SIZE);
+      _gen_put_int(buffer + 16, _gen_stored(gen, block->message, block->part - 1));
+    }
+    else {
+      _gen_put_int(buffer + 4, DBX_BLOCK_DATA);
+      _gen_put_int(buffer + 8, size);
+    }
+    fwrite(buffer, 1, DBX_BLOCK_SIZE, file);
+
+    if (block->garbage) {
+      _gen_garbage(&state, buffer, block->garbage);
+      fwrite(buffer, 1, block->garbage, file);
+    }
+  }
+
+  for (b = 0; b < gen->live_count; b++) {
+    unsigned int size = 0;
+    m = gen->live[b];
+    size = (gen->message[m].info_size + 3) & ~3U;
+    memset(buffer, 0, size);
+    _gen_info(gen, m, gen->message[m].info_offset, buffer);
+    fwrite(buffer, 1, size, file);
+  }
+
+  for (n = 0; n < gen->node_count; n++) {
+    gen_node_t *node = gen->nodes + n;
+    int i = 0;
+    memset(buffer, 0, 24 + 12 * node->count);
+    _gen_put_int(buffer, node->offset);
+    _gen_put_int(buffer + 8, node->child);
+    buffer[17] = node->count;
+    _gen_put_int(buffer + 20, node->child_count);
+    for (i = 0; i < node->count; i++) {
+      unsigned char *entry = buffer + 24 + 12 * i;
+      _gen_put_int(entry, gen->message[_gen_entry(gen, node, i)].info_offset);
+      _gen_put_int(entry + 4, node->children[i]);
+      _gen_put_int(entry + 8, node->child_counts[i]);
+    }
+    fwrite(buffer, 1, 24 + 12 * node->count, file);
+  }
+
+  free(body);
+  free(buffer);
+}
+
+/* the chains that recovery should find, one per line: group offset
+   (stored offset minus file position), deleted flag, offsets of the
+   first and last blocks, and number of blocks */
+static void _gen_truth(gen_t *gen, FILE *file)
+{
+  int m = 0;
+
+  fprintf(file, "# offset deleted first last fragments\n");
+  for (m = 0; m < gen->messages; m++) {
+    int parts = (gen->message[m].size + DBX_BLOCK_DATA - 1) / DBX_BLOCK_DATA;
+    fprintf(file, "%lld %d %u %u %d\n",
+            (long long int)gen->message[m].shift - gen->base,
+            gen->message[m].deleted,
+            _gen_stored(gen, m, 0),
+            _gen_stored(gen, m, parts - 1),
+            parts);
+  }
+}
+
+static void _usage(char *prog, int rc)
+{
+  FILE *stream = (rc == EXIT_SUCCESS)? stdout:stderr;
+
+  fprintf(stream,
+          "Usage: %s [<OPTION>] <DBX-FILE>\n"
+          "\n"
+          "Options:\n"
+          "\t-h, --help            \t show this message\n"
+          "\t-n, --messages N      \t number of messages [default: 10000]\n"
+          "\t-z, --sizes MIN:MAX   \t message sizes, distributed log-uniformly\n"
+          "\t                      \t [default: 500:50000]\n"
+          "\t-f, --fanout N        \t messages per index node, which sets the\n"
+          "\t                      \t index tree depth [default: 32]\n"
+          "\t-F, --fragmentation P \t fraction of message blocks that are moved\n"
+          "\t                      \t to a random place [default: 0.1]\n"
+          "\t-d, --deleted P       \t fraction of messages that are deleted\n"
+          "\t                      \t [default: 0]\n"
+          "\t-s, --shifted P       \t fraction of messages whose offsets are\n"
+          "\t                      \t relative to another base [default: 0]\n"
+          "\t-g, --garbage P       \t fraction of message blocks followed by\n"
+          "\t                      \t random garbage [default: 0]\n"
+          "\t-b, --base N          \t prepend N bytes of garbage (N is rounded\n"
+          "\t                      \t up to a multiple of 4) [default: 0]\n"
+          "\t-t, --truth FILE      \t write the list of message chains\n"
+          "\t-l, --latin1          \t put 8-bit characters in subjects\n"
+          "\t-S, --seed N          \t random seed [default: 1]\n",
+          prog);
+
+  exit(rc);
+}
+
+int main(int argc, char *argv[])
+{
+  gen_t gen;
+  char *truth = NULL;
+  FILE *file = NULL;
+  int c = -1;
+  int n = 0;
+
+  memset(&gen, 0, sizeof(gen));
+  gen.messages = 10000;
+  gen.min_size = 500;
+  gen.max_size = 50000;
+  gen.fanout = 32;
+  gen.fragmentation = 0.1;
+  gen.seed = 1;
+
+  while (1) {
+    static struct option long_options[] = {
+      {"help", no_argument, NULL, 'h'},
+      {"messages", required_argument, NULL, 'n'},
+      {"sizes", required_argument, NULL, 'z'},
+      {"fanout", required_argument, NULL, 'f'},
+      {"fragmentation", required_argument, NULL, 'F'},
+      {"seed", required_argument, NULL, 'S'},
+      {"deleted", required_argument, NULL, 'd'},
+      {"shifted", required_argument, NULL, 's'},
+      {"garbage", required_argument, NULL, 'g'},
+      {"base", required_argument, NULL, 'b'},
+      {"truth", required_argument, NULL, 't'},
+      {"latin1", no_argument, NULL, 'l'},
+      {0, 0, 0, 0}
+    };
+
+    c = getopt_long(argc, argv, "hn:z:f:F:S:d:s:g:b:t:l", long_options, NULL);
+    if (c == -1 || c == '?' || c == ':')
+      break;
+
+    switch (c) {
+    case 'h':
+      _usage(argv[0], EXIT_SUCCESS);
+      break;
+    case 'n':
+      gen.messages = atoi(optarg);
+      break;
+    case 'z':
+      if (sscanf(optarg, "%u:%u", &gen.min_size, &gen.max_size) != 2)
+        _usage(argv[0], EXIT_FAILURE);
+      break;
+    case 'f':
+      gen.fanout = atoi(optarg);
+      break;
+    case 'F':
+      gen.fragmentation = atof(optarg);
+      break;
+    case 'S':
+      gen.seed = strtoul(optarg, NULL, 10);
+      break;
+    case 'd':
+      gen.deleted = atof(optarg);
+      break;
+    case 's':
+      gen.shifted = atof(optarg);
+      break;
+    case 'g':
+      gen.garbage = atof(optarg);
+      break;
+    case 'b':
+      gen.base = (strtoul(optarg, NULL, 0) + 3) & ~3U;
+      break;
+    case 't':
+      truth = optarg;
+      break;
+    case 'l':
+      gen.latin1 = 1;
+      break;
+    default:
+      break;
+    }
+  }
+
+  if (c == '?' || argc - optind != 1 ||
+      gen.messages < 0 || gen.min_size < 1 || gen.max_size < gen.min_size ||
+      gen.fanout < 2 || gen.fanout > DBX_MAX_FANOUT)
+    _usage(argv[0], EXIT_FAILURE);
+
+  _gen_layout(&gen);
+
+  file = fopen(argv[optind], "wb");
+  if (file == NULL) {
+    perror("dbxgen (fopen)");
+    exit(EXIT_FAILURE);
+  }
+  _gen_write(&gen, file);
+  if (fclose(file) != 0) {
+    perror("dbxgen (fclose)");
+    exit(EXIT_FAILURE);
+  }
+
+  if (truth) {
+    file = fopen(truth, "w");
+    if (file == NULL) {
+      perror("dbxgen (fopen)");
+      exit(EXIT_FAILURE);
+    }
+    _gen_truth(&gen, file);
+    if (fclose(file) != 0) {
+      perror("dbxgen (fclose)");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  printf("%s: %d messages (%d indexed), %u bytes, index depth %d\n",
+         argv[optind], gen.messages, gen.live_count, gen.size, gen.depth);
+
+  for (n = 0; n < gen.node_count; n++) {
+    free(gen.nodes[n].children);
+    free(gen.nodes[n].child_counts);
+  }
+  free(gen.nodes);
+  free(gen.block_index);
+  free(gen.blocks);
+  free(gen.live);
+  free(gen.message);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,251 @@
+/*
+    UnDBX - Tool to extract e-mail messages from Outlook Express DBX files.
+    Copyright (C) 2008-2015 Avi Rozen <avi.rozen@gmail.com>
+
+    DBX file format parsing code is based on DbxConv - a DBX to MBOX
+    Converter.  Copyright (C) 2008, 2009 Ulrich Krebs
+    <ukrebs@freenet.de>
+
+    RFC-2822 and RFC-2047 parsing code is adapted from GNU Mailutils -
+    a suite of utilities for electronic mail, Copyright (C) 2002,
+    2003, 2004, 2005, 2006, 2009, 2010 Free Software Foundation, Inc.
+
+    This file is part of UnDBX.
+
+    UnDBX is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dbxmanifest.h"
+
+#define DBX_MANIFEST_NAME ".undbx"
+#define DBX_MANIFEST_MAGIC "UnDBX manifest 2\n"
+#define DBX_MANIFEST_LINE (FILENAME_MAX + 64)
+
+#ifndef WIN32
+# define DBX_MANIFEST_ULL "%llu"
+#else
+# define DBX_MANIFEST_ULL "%I64u"
+#endif
+
+dbx_manifest_t *dbx_manifest_new(int entry_count)
+{
+  dbx_manifest_t *manifest = (dbx_manifest_t *)calloc(1, sizeof(dbx_manifest_t));
+
+  if (manifest == NULL)
+    return NULL;
+
+  if (entry_count > 0) {
+    manifest->entries = (dbx_manifest_entry_t *)calloc(entry_count, sizeof(dbx_manifest_entry_t));
+    if (manifest->entries == NULL) {
+      free(manifest);
+      return NULL;
+    }
+  }
+
+  return manifest;
+}
+
+void dbx_manifest_free(dbx_manifest_t *manifest)
+{
+  int i = 0;
+
+  if (manifest == NULL)
+    return;
+
+  for (i = 0; i < manifest->entry_count; i++)
+    free(manifest->entries[i].filename);
+  free(manifest->entries);
+  free(manifest);
+}
+
+/* read a single line, which must fit the buffer */
+static char *_dbx_manifest_line(FILE *file, char *line)
+{
+  size_t n = 0;
+
+  if (fgets(line, DBX_MANIFEST_LINE, file) == NULL)
+    return NULL;
+
+  n = strlen(line);
+  if (n == 0 || line[n - 1] != '\n')
+    return NULL;
+  line[n - 1] = '\0';
+
+  return line;
+}
+
+static int _dbx_manifest_number(char **p, unsigned long long int *value)
+{
+  char *e = NULL;
+
+  *value = strtoull(*p, &e, 10);
+  if (e == *p || *e != ' ')
+    return 0;
+
+  *p = e + 1;
+  return 1;
+}
+
+static int _dbx_manifest_entry(char *line, dbx_manifest_entry_t *entry)
+{
+  unsigned long long int index = 0;
+  unsigned long long int offset = 0;
+
+  if (!_dbx_manifest_number(&line, &index) ||
+      !_dbx_manifest_number(&line, &offset) ||
+      !_dbx_manifest_number(&line, &entry->size) ||
+      *line == '\0')
+    return 0;
+
+  entry->index = (int)index;
+  entry->offset = (int)offset;
+  entry->filename = strdup(line);
+
+  return (entry->filename != NULL);
+}
+
+/* load the manifest, but only if it is complete, and nothing in the
+   directory was added, removed or renamed since it was written: the
+   directory's modification time may be set back, but its status change
+   time may not */
+dbx_manifest_t *dbx_manifest_load(sys_dir_t dir)
+{
+  FILE *file = NULL;
+  dbx_manifest_t *manifest = NULL;
+  char *line = NULL;
+  int count = 0;
+  int i = 0;
+  int ok = 0;
+
+  file = sys_dir_fopen(dir, DBX_MANIFEST_NAME, "rb");
+  if (file == NULL)
+    return NULL;
+
+  line = (char *)malloc(DBX_MANIFEST_LINE);
+  if (line == NULL)
+    goto MANIFEST_DONE;
+
+  if (fgets(line, DBX_MANIFEST_LINE, file) == NULL || strcmp(line, DBX_MANIFEST_MAGIC) != 0)
+    goto MANIFEST_DONE;
+
+  if (_dbx_manifest_line(file, line) == NULL || sscanf(line, "count %d", &count) != 1 || count < 0)
+    goto MANIFEST_DONE;
+
+  manifest = dbx_manifest_new(count);
+  if (manifest == NULL)
+    goto MANIFEST_DONE;
+
+  if (_dbx_manifest_line(file, line) == NULL ||
+      sscanf(line, "dbx " DBX_MANIFEST_ULL " " DBX_MANIFEST_ULL " " DBX_MANIFEST_ULL,
+             &manifest->dbx_size, &manifest->dbx_mtime, &manifest->dbx_digest) != 3)
+    goto MANIFEST_DONE;
+
+  if (_dbx_manifest_line(file, line) == NULL ||
+      sscanf(line, "options %d", &manifest->options) != 1)
+    goto MANIFEST_DONE;
+
+  if (_dbx_manifest_line(file, line) == NULL ||
+      sscanf(line, "dir " DBX_MANIFEST_ULL " " DBX_MANIFEST_ULL,
+             &manifest->dir_mtime, &manifest->dir_ctime) != 2)
+    goto MANIFEST_DONE;
+
+  for (i = 0; i < count; i++) {
+    dbx_manifest_entry_t *entry = manifest->entries + i;
+    if (_dbx_manifest_line(file, line) == NULL || !_dbx_manifest_entry(line, entry))
+      goto MANIFEST_DONE;
+    manifest->entry_count++;
+    /* entries are written sorted by file name */
+    if (i > 0 && strcmp(entry[-1].filename, entry->filename) >= 0)
+      goto MANIFEST_DONE;
+  }
+
+  ok = (_dbx_manifest_line(file, line) != NULL &&
+        strcmp(line, "end") == 0 &&
+        fgetc(file) == EOF &&
+        manifest->dir_mtime != 0 &&
+        manifest->dir_ctime != 0 &&
+        manifest->dir_mtime == sys_dir_mtime(dir, NULL) &&
+        manifest->dir_ctime == sys_dir_ctime(dir, NULL));
+
+ MANIFEST_DONE:
+  free(line);
+  fclose(file);
+  if (!ok) {
+    dbx_manifest_free(manifest);
+    manifest = NULL;
+  }
+
+  return manifest;
+}
+
+/* the manifest file is created before the directory time is taken,
+   and is then rewritten in place, which leaves the directory as is */
+int dbx_manifest_save(dbx_manifest_t *manifest, sys_dir_t dir)
+{
+  FILE *file = NULL;
+  int i = 0;
+  int rc = 0;
+
+  file = sys_dir_fopen(dir, DBX_MANIFEST_NAME, "wb");
+  if (file == NULL)
+    return -1;
+
+  manifest->dir_mtime = sys_dir_mtime(dir, NULL);
+  manifest->dir_ctime = sys_dir_ctime(dir, NULL);
+
+  fprintf(file, DBX_MANIFEST_MAGIC);
+  fprintf(file, "count %d\n", manifest->entry_count);
+  fprintf(file, "dbx " DBX_MANIFEST_ULL " " DBX_MANIFEST_ULL " " DBX_MANIFEST_ULL "\n",
+          manifest->dbx_size, manifest->dbx_mtime, manifest->dbx_digest);
+  fprintf(file, "options %d\n", manifest->options);
+  fprintf(file, "dir " DBX_MANIFEST_ULL " " DBX_MANIFEST_ULL "\n",
+          manifest->dir_mtime, manifest->dir_ctime);
+  for (i = 0; i < manifest->entry_count; i++) {
+    dbx_manifest_entry_t *entry = manifest->entries + i;
+    fprintf(file, "%d %d " DBX_MANIFEST_ULL " %s\n",
+            entry->index, entry->offset, entry->size, entry->filename);
+  }
+  fprintf(file, "end\n");
+
+  if (ferror(file) || manifest->dir_mtime == 0 || manifest->dir_ctime == 0)
+    rc = -1;
+  if (fclose(file) != 0)
+    rc = -1;
+  if (rc != 0)
+    dbx_manifest_invalidate(dir);
+
+  return rc;
+}
+
+/* truncate an existing manifest, so it is not trusted if this run
+   does not complete */
+void dbx_manifest_invalidate(sys_dir_t dir)
+{
+  FILE *file = sys_dir_fopen(dir, DBX_MANIFEST_NAME, "r+b");
+
+  if (file == NULL)
+    return;
+  fclose(file);
+
+  file = sys_dir_fopen(dir, DBX_MANIFEST_NAME, "wb");
+  if (file)
+    fclose(file);
+}
@@ -0,0 +1,70 @@
+/*
+    UnDBX - Tool to extract e-mail messages from Outlook Express DBX files.
+    Copyright (C) 2008-2015 Avi Rozen <avi.rozen@gmail.com>
+
+    DBX file format parsing code is based on DbxConv - a DBX to MBOX
+    Converter.  Copyright (C) 2008, 2009 Ulrich Krebs
+    <ukrebs@freenet.de>
+
+    RFC-2822 and RFC-2047 parsing code is adapted from GNU Mailutils -
+    a suite of utilities for electronic mail, Copyright (C) 2002,
+    2003, 2004, 2005, 2006, 2009, 2010 Free Software Foundation, Inc.
+
+    This file is part of UnDBX.
+
+    UnDBX is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _DBX_MANIFEST_H_
+#define _DBX_MANIFEST_H_
+
+#include "dbxsys.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  /* one extracted message, as it was left on disk by the previous run */
+  typedef struct {
+    int index;
+    int offset;
+    unsigned long long int size;
+    char *filename;
+  } dbx_manifest_entry_t;
+
+  /* the manifest is kept in each output directory, and lets the next
+     run synchronize it without listing or stat-ing its files, or skip
+     the dbx file altogether if it was not modified */
+  typedef struct {
+    unsigned long long int dbx_size;
+    unsigned long long int dbx_mtime;
+    unsigned long long int dbx_digest;
+    int options;
+    unsigned long long int dir_mtime;
+    unsigned long long int dir_ctime;
+    int entry_count;
+    dbx_manifest_entry_t *entries;
+  } dbx_manifest_t;
+
+  dbx_manifest_t *dbx_manifest_new(int entry_count);
+  void dbx_manifest_free(dbx_manifest_t *manifest);
+  dbx_manifest_t *dbx_manifest_load(sys_dir_t dir);
+  int dbx_manifest_save(dbx_manifest_t *manifest, sys_dir_t dir);
+  void dbx_manifest_invalidate(sys_dir_t dir);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* _DBX_MANIFEST_H_ */
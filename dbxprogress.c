@@ -33,25 +33,80 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include "dbxsys.h"
 #include "dbxprogress.h"
 
+/* minimum interval between JSON progress events of a single bar */
+#define DBX_PROGRESS_INTERVAL 0.5
+
+/* interval at which progress counters are sampled and rendered */
+#define DBX_PROGRESS_TICK 0.1
+
+#ifndef WIN32
+# define DBX_PROGRESS_ULL "%llu"
+#else
+# define DBX_PROGRESS_ULL "%I64u"
+#endif
 
 typedef struct dbx_progress_bar_s {
   int enabled;
   int verbose;
-  float max;
-  float last;
-  float delta;
+  unsigned long long int max;
+  unsigned long long int last;
+  unsigned long long int delta;
+  int items;
+  double start;
+  double reported;
+  unsigned long long int done;
+  unsigned long long int bytes;
+  sys_ticker_t ticker;
+  int untimed;
+  unsigned long long int parent_counter;
+  unsigned long long int parent_bytes;
 } dbx_progress_bar_t;
 
 
+typedef struct dbx_progress_output_s {
+  FILE *stream;
+  char *text;
+  size_t length;
+  struct dbx_progress_output_s *next;
+} dbx_progress_output_t;
+
+
 typedef struct dbx_progress_s {
   dbx_verbosity_t verbosity;
   dbx_progress_bar_t *bars;
   int count;
+  int buffered;
+  dbx_progress_output_t *output;
+  dbx_progress_output_t *output_last;
+  char *name;
+  volatile unsigned long long int counter;
+  volatile unsigned long long int bytes;
+  int verbose;
+  int untimed;
+  sys_mutex_t mutex;
 } dbx_progress_t;
 
 
+/* normal output goes to stdout, unless stdout is taken by the messages */
+static FILE *_dbx_progress_stdout = NULL;
+
+/* if set, progress is reported as JSON lines on this stream instead */
+static FILE *_dbx_progress_events = NULL;
+static double _dbx_progress_epoch = 0;
+
+static const char *_dbx_status_event[DBX_STATUS_LAST + 1] = {
+  "saved",
+  "deleted",
+  "moved",
+  "warning",
+  "error",
+  "unknown"
+};
+
 static const char *_dbx_status_label[DBX_STATUS_LAST + 1] = {
   "OK",
   "DELETED",
@@ -62,26 +117,86 @@ static const char *_dbx_status_label[DBX_STATUS_LAST + 1] = {
 };
 
 
-static void _dbx_progress_vprintf(dbx_status_t status,
+static void _dbx_progress_append(dbx_progress_handle_t handle,
+                                 FILE *stream,
+                                 const char *text,
+                                 size_t length)
+{
+  char *buffer = NULL;
+  dbx_progress_output_t *output = handle->output_last;
+
+  if (length == 0)
+    return;
+
+  /* consecutive text written to the same stream is kept together */
+  if (output == NULL || output->stream != stream) {
+    output = (dbx_progress_output_t *)calloc(1, sizeof(dbx_progress_output_t));
+    if (output == NULL) {
+      perror("_dbx_progress_append (calloc)");
+      return;
+    }
+    output->stream = stream;
+    if (handle->output_last)
+      handle->output_last->next = output;
+    else
+      handle->output = output;
+    handle->output_last = output;
+  }
+
+  buffer = (char *)realloc(output->text, output->length + length);
+  if (buffer == NULL) {
+    perror("_dbx_progress_append (realloc)");
+    return;
+  }
+  memcpy(buffer + output->length, text, length);
+  output->text = buffer;
+  output->length += length;
+}
+
+
+static void _dbx_progress_vprintf(dbx_progress_handle_t handle,
+                                  dbx_status_t status,
                                   char *prefix,
                                   char *format,
                                   va_list ap,
                                   char *suffix)
 {
-  FILE *stream = (status < DBX_STATUS_WARNING)? stdout:stderr;
+  FILE *stream = (status < DBX_STATUS_WARNING)? (_dbx_progress_stdout? _dbx_progress_stdout:stdout) : stderr;
+
+  if (handle && handle->buffered) {
+    _dbx_progress_append(handle, stream, prefix, strlen(prefix));
+    if (format) {
+      char *text = NULL;
+      int length = 0;
+      va_list aq;
+      va_copy(aq, ap);
+      length = vsnprintf(NULL, 0, format, aq);
+      va_end(aq);
+      if (length > 0 && (text = (char *)malloc(length + 1)) != NULL) {
+        vsnprintf(text, length + 1, format, ap);
+        _dbx_progress_append(handle, stream, text, length);
+        free(text);
+      }
+    }
+    _dbx_progress_append(handle, stream, suffix, strlen(suffix));
+    return;
+  }
+
+  sys_mutex_lock(NULL);
   fputs(prefix, stream);
   if (format)
     vfprintf(stream, format, ap);
   fputs(suffix, stream);
   fflush(stream);
+  sys_mutex_unlock(NULL);
 }
 
 
-static void _dbx_progress_printf(dbx_status_t status, char *format, ...)
+static void _dbx_progress_printf(dbx_progress_handle_t handle, dbx_status_t status, char *format, ...)
 {
   va_list ap;
   va_start(ap, format);
-  _dbx_progress_vprintf(status, "", format, ap, "");
+  _dbx_progress_vprintf(handle, status, "", format, ap, "");
   va_end(ap);
 }
 
@@ -93,36 +208,173 @@ static const char *_dbx_status_string(dbx_status_t status)
   return _dbx_status_label[status];
 }
 
-static void _dbx_progress_update(dbx_status_t status,
+static char *_dbx_progress_vformat(char *format, va_list ap)
+{
+  char *text = NULL;
+  int length = 0;
+  va_list aq;
+
+  if (format == NULL)
+    return NULL;
+  va_copy(aq, ap);
+  length = vsnprintf(NULL, 0, format, aq);
+  va_end(aq);
+  if (length >= 0 && (text = (char *)malloc(length + 1)) != NULL)
+    vsnprintf(text, length + 1, format, ap);
+  return text;
+}
+
+/* write one event as a line of JSON: fields is a printf format for the
+   fields that follow the event type and file, and text, if given, is
+   the value of key */
+static void _dbx_progress_event(dbx_progress_handle_t handle,
+                                const char *event,
+                                const char *key,
+                                const char *text,
+                                const char *fields, ...)
+{
+  FILE *stream = _dbx_progress_events;
+  va_list ap;
+
+  sys_mutex_lock(NULL);
+  fprintf(stream, "{\"time\": %.3f, \"event\": \"%s\"", sys_clock() - _dbx_progress_epoch, event);
+  if (handle && handle->name) {
+    fputs(", \"file\": ", stream);
+    sys_fputs_json(handle->name, stream);
+  }
+  if (fields) {
+    va_start(ap, fields);
+    vfprintf(stream, fields, ap);
+    va_end(ap);
+  }
+  if (text) {
+    fprintf(stream, ", \"%s\": ", key);
+    sys_fputs_json(text, stream);
+  }
+  fputs("}\n", stream);
+  /* frequent per message events are left to the stream's buffer */
+  if (strcmp(event, "saved") != 0)
+    fflush(stream);
+  sys_mutex_unlock(NULL);
+}
+
+/* report done items out of the bar's total, as a JSON progress event
+   (rate limited, except for the last one) or as a percentage */
+static void _dbx_progress_render(dbx_progress_handle_t handle,
                                  dbx_progress_bar_t *bar,
-                                 unsigned int n,
-                                 char *format,
-                                 va_list ap)
-{
-  if (format == NULL || !bar->verbose) {
-    if (n + 1 != 0) {
-      if ((n + 1) < bar->max && n - bar->last < bar->delta)
-        return;
-      bar->last = n;
-      _dbx_progress_printf(DBX_STATUS_OK, "\b\b\b\b\b\b%5.1f%%", (n + 1) / bar->max * 100.0);
-      fflush(stdout);
-    }
+                                 unsigned long long int done)
+{
+  if (done > bar->max)
+    done = bar->max;
+  if (done == 0 || done == bar->done)
+    return;
+  bar->done = done;
+
+  if (_dbx_progress_events) {
+    double now = sys_clock();
+    double elapsed = 0;
+    double rate = 0;
+
+    if (now - bar->reported < DBX_PROGRESS_INTERVAL && done < bar->max)
+      return;
+    bar->reported = now;
+    bar->bytes = sys_atomic_add_long_long(&handle->bytes, 0);
+
+    elapsed = now - bar->start;
+    rate = (elapsed > 0)? (double)done / elapsed : 0;
+    _dbx_progress_event(handle, "progress", NULL, NULL,
+                        ", \"done\": " DBX_PROGRESS_ULL ", \"total\": " DBX_PROGRESS_ULL
+                        ", \"bytes\": " DBX_PROGRESS_ULL
+                        ", \"rate\": %.1f, \"throughput\": %.0f, \"eta\": %.1f",
+                        done, bar->max, bar->bytes,
+                        rate, (elapsed > 0)? bar->bytes / elapsed : 0,
+                        (rate > 0 && done < bar->max)? (double)(bar->max - done) / rate : 0);
+    return;
   }
-  else {
-    if (n + 1 != 0) 
-      _dbx_progress_printf(DBX_STATUS_OK, "\n%5.1f%% ", (n + 1) / bar->max * 100.0);
+
+  /* a buffered progress bar would just be noise, and once items were
+     listed there's no percentage to overwrite */
+  if (handle->buffered || bar->items)
+    return;
+  if (done < bar->max && done - bar->last < bar->delta)
+    return;
+  bar->last = done;
+  _dbx_progress_printf(handle, DBX_STATUS_OK, "\b\b\b\b\b\b%5.1f%%", (double)done / bar->max * 100.0);
+}
+
+/* called by the ticker, so that counting progress costs the hot loops
+   only an atomic add */
+static void _dbx_progress_tick(void *arg)
+{
+  dbx_progress_handle_t handle = (dbx_progress_handle_t)arg;
+
+  sys_mutex_lock(handle->mutex);
+  if (handle->count > 0)
+    _dbx_progress_render(handle,
+                         handle->bars + handle->count - 1,
+                         sys_atomic_add_long_long(&handle->counter, 0));
+  sys_mutex_unlock(handle->mutex);
+}
+
+static void _dbx_progress_item(dbx_progress_handle_t handle,
+                               dbx_status_t status,
+                               dbx_progress_bar_t *bar,
+                               unsigned long long int size,
+                               char *format,
+                               va_list ap)
+{
+  if (format == NULL || !(bar->verbose || status >= DBX_STATUS_WARNING))
+    return;
+
+  if (_dbx_progress_events) {
+    char *text = _dbx_progress_vformat(format, ap);
+    if (size)
+      _dbx_progress_event(handle, _dbx_status_event[status], "name", text,
+                          ", \"size\": " DBX_PROGRESS_ULL, size);
+    else
+      _dbx_progress_event(handle, _dbx_status_event[status], "name", text, NULL);
+    free(text);
+  }
+  else if (bar->verbose) {
+    unsigned long long int done = sys_atomic_add_long_long(&handle->counter, 0);
+    bar->items = 1;
+    if (done)
+      _dbx_progress_printf(handle, DBX_STATUS_OK, "\n%5.1f%% ", (double)done / bar->max * 100.0);
     else
-      _dbx_progress_printf(DBX_STATUS_OK, "\n       ");
-    _dbx_progress_printf(DBX_STATUS_OK, "[%-7s] ", _dbx_status_string(status));
-    _dbx_progress_vprintf(DBX_STATUS_OK, "", format, ap, "");
+      _dbx_progress_printf(handle, DBX_STATUS_OK, "\n       ");
+    _dbx_progress_printf(handle, DBX_STATUS_OK, "[%-7s] ", _dbx_status_string(status));
+    _dbx_progress_vprintf(handle, DBX_STATUS_OK, "", format, ap, "");
   }
 }
 
+void dbx_progress_set_output(FILE *stream)
+{
+  _dbx_progress_stdout = stream;
+}
+
+/* report progress as JSON lines on stream, instead of as text */
+void dbx_progress_set_events(FILE *stream)
+{
+  _dbx_progress_events = stream;
+  _dbx_progress_epoch = sys_clock();
+}
+
+/* events are tagged with the name, usually that of the dbx file */
+void dbx_progress_set_name(dbx_progress_handle_t handle, char *name)
+{
+  if (handle == NULL)
+    return;
+  free(handle->name);
+  handle->name = name? strdup(name) : NULL;
+}
+
 dbx_progress_handle_t dbx_progress_new(dbx_verbosity_t level)
 {
   dbx_progress_handle_t handle = (dbx_progress_handle_t) calloc(1, sizeof(dbx_progress_t));
-  if (handle) 
+  if (handle) {
     handle->verbosity = level;
+    handle->mutex = sys_mutex_new();
+  }
   else 
     perror("dbx_progress_new (calloc)");
   return handle;
@@ -131,26 +383,83 @@ dbx_progress_handle_t dbx_progress_new(dbx_verbosity_t level)
 
 void dbx_progress_delete(dbx_progress_handle_t handle)
 {
-  if (handle) 
+  if (handle) {
+    dbx_progress_flush(handle);
+    sys_mutex_delete(handle->mutex);
+    free(handle->name);
     free(handle);
+  }
+}
+
+
+void dbx_progress_set_buffered(dbx_progress_handle_t handle, int buffered)
+{
+  if (handle == NULL)
+    return;
+  if (!buffered)
+    dbx_progress_flush(handle);
+  handle->buffered = buffered;
+}
+
+
+void dbx_progress_flush(dbx_progress_handle_t handle)
+{
+  dbx_progress_output_t *output = NULL;
+
+  if (handle == NULL)
+    return;
+
+  sys_mutex_lock(handle->mutex);
+
+  /* write all buffered output at once, so that it doesn't
+     interleave with output from other threads */
+  if (handle->output) {
+    sys_mutex_lock(NULL);
+    for (output = handle->output; output; output = output->next) {
+      fwrite(output->text, 1, output->length, output->stream);
+      fflush(output->stream);
+    }
+    sys_mutex_unlock(NULL);
+  }
+
+  while (handle->output) {
+    output = handle->output;
+    handle->output = output->next;
+    free(output->text);
+    free(output);
+  }
+  handle->output_last = NULL;
+
+  sys_mutex_unlock(handle->mutex);
 }
   
 
 void dbx_progress_push(dbx_progress_handle_t handle,
                        dbx_verbosity_t level,
-                       unsigned int n,
+                       unsigned long long int n,
                        char *format, ...)
 {
   dbx_progress_bar_t *bar = NULL;
   dbx_progress_bar_t *bars = NULL;
+  int ticking = 0;
+  int k = 0;
 
   if (handle == NULL)
     return;
   
+  sys_mutex_lock(handle->mutex);
+
+  /* an enclosing bar's ticker renders this bar too */
+  for (k = 0; k < handle->count; k++) {
+    if (handle->bars[k].ticker)
+      ticking = 1;
+  }
+
   bars = (dbx_progress_bar_t *)realloc(handle->bars,
                                        (handle->count + 1) * sizeof(dbx_progress_bar_t));
   if (bars == NULL) {
     perror("dbx_progress_push (realloc)");
+    sys_mutex_unlock(handle->mutex);
     return;
   }
   
@@ -161,33 +470,102 @@ void dbx_progress_push(dbx_progress_handle_t handle,
   bar->enabled = (level <= handle->verbosity);
   bar->verbose = (level <  handle->verbosity);
   bar->last = 0;
-  bar->max = (float) n;
-  bar->delta = bar->max / 1000.0;
+  bar->max = n;
+  bar->delta = n / 1000;
+  bar->items = 0;
+  bar->start = sys_clock();
+  bar->reported = bar->start;
+  bar->done = 0;
+  bar->bytes = 0;
+  bar->ticker = NULL;
+  bar->untimed = 0;
+
+  /* the counters are the innermost bar's: those of the enclosing bar
+     are restored when this one is popped */
+  bar->parent_counter = sys_atomic_add_long_long(&handle->counter, 0);
+  bar->parent_bytes = sys_atomic_add_long_long(&handle->bytes, 0);
+  sys_atomic_set_long_long(&handle->counter, 0);
+  sys_atomic_set_long_long(&handle->bytes, 0);
+
+  if (bar->enabled && n > 0 && (_dbx_progress_events || !handle->buffered) && !ticking) {
+    bar->ticker = sys_ticker_new(DBX_PROGRESS_TICK, _dbx_progress_tick, handle);
+    bar->untimed = (bar->ticker == NULL);
+  }
+  handle->verbose = bar->enabled && bar->verbose;
+  handle->untimed = bar->untimed;
 
-  if (bar->enabled) {
+  if (bar->enabled && _dbx_progress_events) {
+    va_list ap;
+    char *text = NULL;
+    va_start(ap, format);
+    text = _dbx_progress_vformat(format, ap);
+    va_end(ap);
+    _dbx_progress_event(handle, "start", "text", text, ", \"total\": " DBX_PROGRESS_ULL, n);
+    free(text);
+  }
+  else if (bar->enabled) {
     va_list ap;
     va_start(ap, format);
-    _dbx_progress_vprintf(DBX_STATUS_OK, "", format, ap, ":       ");
+    _dbx_progress_vprintf(handle, DBX_STATUS_OK, "", format, ap, ":       ");
     va_end(ap);
   }
+
+  sys_mutex_unlock(handle->mutex);
 }
 
 
 void dbx_progress_pop(dbx_progress_handle_t handle, char *format, ...)
 {
-  dbx_progress_bar_t *bar = handle->bars + handle->count - 1;
+  dbx_progress_bar_t *bar = NULL;
   dbx_progress_bar_t *bars = NULL;
 
-  if (handle == NULL || handle->count == 0)
+  if (handle == NULL)
+    return;
+
+  sys_mutex_lock(handle->mutex);
+
+  if (handle->count == 0) {
+    sys_mutex_unlock(handle->mutex);
     return;
+  }
   
-  if (bar->enabled) {
+  /* the ticker takes the lock, so it's stopped without holding it */
+  bar = handle->bars + handle->count - 1;
+  if (bar->ticker) {
+    sys_ticker_t ticker = bar->ticker;
+    bar->ticker = NULL;
+    sys_mutex_unlock(handle->mutex);
+    sys_ticker_delete(ticker);
+    sys_mutex_lock(handle->mutex);
+    bar = handle->bars + handle->count - 1;
+  }
+
+  if (bar->enabled)
+    _dbx_progress_render(handle, bar, sys_atomic_add_long_long(&handle->counter, 0));
+
+  if (bar->enabled && _dbx_progress_events) {
     va_list ap;
+    char *text = NULL;
     va_start(ap, format);
-    _dbx_progress_vprintf(DBX_STATUS_OK, "\n", format, ap, format? "\n":"");
+    text = _dbx_progress_vformat(format, ap);
+    va_end(ap);
+    bar->bytes = sys_atomic_add_long_long(&handle->bytes, 0);
+    _dbx_progress_event(handle, "end", "text", text,
+                        ", \"done\": " DBX_PROGRESS_ULL ", \"total\": " DBX_PROGRESS_ULL
+                        ", \"bytes\": " DBX_PROGRESS_ULL ", \"seconds\": %.3f",
+                        bar->done, bar->max, bar->bytes, sys_clock() - bar->start);
+    free(text);
+  }
+  else if (bar->enabled) {
+    va_list ap;
+    va_start(ap, format);
+    _dbx_progress_vprintf(handle, DBX_STATUS_OK, "\n", format, ap, format? "\n":"");
     va_end(ap);
   }
 
+  sys_atomic_set_long_long(&handle->counter, bar->parent_counter);
+  sys_atomic_set_long_long(&handle->bytes, bar->parent_bytes);
+
   if (handle->count == 1) {
     free(handle->bars);
   }
@@ -196,32 +574,106 @@ void dbx_progress_pop(dbx_progress_handle_t handle, char *format, ...)
                                          (handle->count - 1) * sizeof(dbx_progress_bar_t));
     if (bars == NULL) {
       perror("dbx_progress_pop (realloc)");
+      sys_mutex_unlock(handle->mutex);
       return;
     }
   }
   
   handle->bars = bars;
   handle->count--;
+
+  bar = (handle->count > 0)? handle->bars + handle->count - 1 : NULL;
+  handle->verbose = bar && bar->enabled && bar->verbose;
+  handle->untimed = bar && bar->untimed;
+
+  sys_mutex_unlock(handle->mutex);
 }
   
 
+static void _dbx_progress_vupdate(dbx_progress_handle_t handle,
+                                  dbx_status_t status,
+                                  unsigned long long int n,
+                                  unsigned long long int bytes,
+                                  char *format,
+                                  va_list ap)
+{
+  dbx_progress_bar_t *bar = NULL;
+
+  if (handle == NULL)
+    return;
+
+  if (status < DBX_STATUS_OK || status >= DBX_STATUS_LAST)
+    status = DBX_STATUS_LAST;
+
+  if (n + 1 != 0)
+    sys_atomic_set_long_long(&handle->counter, n + 1);
+
+  /* items that aren't listed are left for the ticker to count */
+  if (status < DBX_STATUS_WARNING && !handle->verbose && !handle->untimed)
+    return;
+
+  sys_mutex_lock(handle->mutex);
+
+  if (handle->count > 0) {
+    bar = handle->bars + handle->count - 1;
+    if (bar->enabled) {
+      _dbx_progress_item(handle, status, bar, bytes, format, ap);
+      if (handle->untimed)
+        _dbx_progress_render(handle, bar, sys_atomic_add_long_long(&handle->counter, 0));
+    }
+  }
+
+  sys_mutex_unlock(handle->mutex);
+}
+
 void dbx_progress_update(dbx_progress_handle_t handle,
                          dbx_status_t status,
-                         unsigned int n,
+                         unsigned long long int n,
                          char *format, ...)
 {
-  dbx_progress_bar_t *bar = NULL;
+  va_list ap;
+  va_start(ap, format);
+  _dbx_progress_vupdate(handle, status, n, 0, format, ap);
+  va_end(ap);
+}
 
-  if (handle == NULL || handle->count == 0)
+/* same as dbx_progress_update, for an item of the given size in bytes,
+   which is only reported with the item: use dbx_progress_add to count
+   bytes towards the throughput */
+void dbx_progress_update_size(dbx_progress_handle_t handle,
+                              dbx_status_t status,
+                              unsigned long long int n,
+                              unsigned long long int size,
+                              char *format, ...)
+{
+  va_list ap;
+  va_start(ap, format);
+  _dbx_progress_vupdate(handle, status, n, size, format, ap);
+  va_end(ap);
+}
+
+
+/* count n more items, and bytes more bytes, done: this is cheap enough
+   to call from hot loops, and the counter is rendered periodically */
+void dbx_progress_add(dbx_progress_handle_t handle,
+                      unsigned long long int n,
+                      unsigned long long int bytes)
+{
+  if (handle == NULL)
     return;
-  
-  bar = handle->bars + handle->count - 1;
 
-  if (bar->enabled) {
-    va_list ap;
-    va_start(ap, format);
-    _dbx_progress_update(status, bar, n, format, ap);
-    va_end(ap);
+  sys_atomic_add_long_long(&handle->counter, n);
+  if (bytes)
+    sys_atomic_add_long_long(&handle->bytes, bytes);
+
+  /* without a ticker, render here */
+  if (handle->untimed) {
+    sys_mutex_lock(handle->mutex);
+    if (handle->count > 0 && handle->bars[handle->count - 1].enabled)
+      _dbx_progress_render(handle,
+                           handle->bars + handle->count - 1,
+                           sys_atomic_add_long_long(&handle->counter, 0));
+    sys_mutex_unlock(handle->mutex);
   }
 }
 
@@ -232,13 +684,29 @@ void dbx_progress_message(dbx_progress_handle_t handle,
 {
   dbx_progress_bar_t *bar = NULL;
 
+  if (handle)
+    sys_mutex_lock(handle->mutex);
+
   if (handle && handle->count > 0)
     bar = handle->bars + handle->count - 1;
 
-  if (bar == NULL || bar->enabled) {
+  if ((bar == NULL || bar->enabled) && _dbx_progress_events) {
     va_list ap;
+    char *text = NULL;
     va_start(ap, format);
-    _dbx_progress_vprintf(status, "", format, ap, "\n");
+    text = _dbx_progress_vformat(format, ap);
     va_end(ap);
+    _dbx_progress_event(handle, "message", "text", text,
+                        ", \"status\": \"%s\"", _dbx_status_string(status));
+    free(text);
   }
+  else if (bar == NULL || bar->enabled) {
+    va_list ap;
+    va_start(ap, format);
+    _dbx_progress_vprintf(handle, status, "", format, ap, "\n");
+    va_end(ap);
+  }
+
+  if (handle)
+    sys_mutex_unlock(handle->mutex);
 }
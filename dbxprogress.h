@@ -29,6 +29,8 @@
 #ifndef _DBX_PROGRESS_H_
 #define _DBX_PROGRESS_H_
 
+#include <stdio.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -54,19 +56,32 @@ extern "C" {
 
   typedef struct dbx_progress_s *dbx_progress_handle_t;
 
+  void dbx_progress_set_output(FILE *stream);
+  void dbx_progress_set_events(FILE *stream);
   dbx_progress_handle_t dbx_progress_new(dbx_verbosity_t level);
   void dbx_progress_delete(dbx_progress_handle_t handle);
+  void dbx_progress_set_name(dbx_progress_handle_t handle, char *name);
+  void dbx_progress_set_buffered(dbx_progress_handle_t handle, int buffered);
+  void dbx_progress_flush(dbx_progress_handle_t handle);
   
   void dbx_progress_push(dbx_progress_handle_t handle,
                          dbx_verbosity_t level,
-                         unsigned int n,
+                         unsigned long long int n,
                          char *format, ...);
   void dbx_progress_pop(dbx_progress_handle_t handle, char *format, ...);
   
   void dbx_progress_update(dbx_progress_handle_t handle,
                            dbx_status_t status,
-                           unsigned int n,
+                           unsigned long long int n,
                            char *format, ...);
+  void dbx_progress_update_size(dbx_progress_handle_t handle,
+                                dbx_status_t status,
+                                unsigned long long int n,
+                                unsigned long long int size,
+                                char *format, ...);
+  void dbx_progress_add(dbx_progress_handle_t handle,
+                        unsigned long long int n,
+                        unsigned long long int bytes);
   void dbx_progress_message(dbx_progress_handle_t handle,
                             dbx_status_t status,
                             char *format, ...);
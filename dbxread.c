@@ -37,8 +37,61 @@
 #include "dbxread.h"
 #include "emlread.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# include <immintrin.h>
+# define DBX_SCAN_X86 1
+#endif
+
 #define INDEX_POINTER 0xE4
 #define ITEM_COUNT    0xC4
+#define HEADER_SIZE   0x24BC
+
+#define DBX_ARENA_BLOCK             0x10000
+#define DBX_MESSAGE_BLOCKS          64
+
+#define DBX_SCAN_START              0x10
+#define DBX_SCAN_HEADER             0x14
+#define DBX_SCAN_BLOCK              0x800000
+#define DBX_SCAN_ALIGN              0x1000
+#define DBX_SCAN_FRAGMENTS          4096
+#define DBX_SCAN_RANGES_PER_THREAD  4
+
+/* file offsets of fragments and index nodes are multiples of 4 */
+#define DBX_HASH_OFFSET(offset)     (((unsigned int)(offset) >> 2) * 2654435761U)
+
+/* scan groups are keyed by a 64 bit offset difference and a flag */
+#define DBX_HASH_GROUP(offset, deleted) \
+  (DBX_HASH_OFFSET((offset) ^ ((offset) >> 32)) ^ (unsigned int)(deleted))
+
+typedef struct {
+  unsigned long long int position;
+  int chains;
+} dbx_scan_hit_t;
+
+typedef struct {
+  unsigned long long int start;
+  unsigned long long int end;
+  unsigned long long int resume;
+  dbx_chains_t **scan;
+  int scan_count;
+  int *scan_table;
+  int scan_capacity;
+  dbx_scan_hit_t *hits;
+  int hit_count;
+} dbx_scan_range_t;
+
+typedef size_t (*dbx_scan_marker_t)(const unsigned char *p, size_t n);
+
+typedef struct {
+  dbx_t *dbx;
+  dbx_scan_marker_t find_marker;
+  FILE *file;
+  const unsigned char *map;
+  dbx_scan_range_t *ranges;
+  int range_count;
+  int *scan_table;
+  int scan_capacity;
+} dbx_scan_t;
 
 static int _dbx_info_cmp(const dbx_info_t *ia, const dbx_info_t *ib)
 {
@@ -49,17 +102,135 @@ static int _dbx_info_cmp(const dbx_info_t *ia, const dbx_info_t *ib)
   return res;
 }
 
-static char *_dbx_read_string(FILE *file, int offset)
+/* the mapped file, unless it shrank while it was being read: reading
+   past its new end would crash the process, so it is then read instead */
+static const unsigned char *_dbx_map(dbx_t *dbx)
+{
+  return dbx->shrunk? NULL : dbx->map;
+}
+
+/* check, before each message is read, that the mapped file did not
+   shrink (e.g. it was compacted) since it was opened */
+static void _dbx_check_size(dbx_t *dbx)
+{
+  struct stat st;
+
+  if (dbx->map && !dbx->shrunk &&
+      fstat(fileno(dbx->file), &st) == 0 &&
+      (unsigned long long int)st.st_size < dbx->file_size &&
+      sys_atomic_add(&dbx->shrunk, 1) == 1)
+    dbx_progress_message(dbx->progress_handle,
+                         DBX_STATUS_WARNING,
+                         "DBX file %s was truncated while it was read",
+                         dbx->filename);
+}
+
+/* return a pointer to size bytes at offset: the bytes are either
+   read into buffer, or else point directly into the mapped file.
+   neither way depends on the file position, so this is safe to
+   call from concurrent threads */
+static const unsigned char *_dbx_fetch(dbx_t *dbx, unsigned long long int offset, size_t size, void *buffer)
+{
+  const unsigned char *map = _dbx_map(dbx);
+
+  if (offset > dbx->file_size || size > dbx->file_size - offset)
+    return NULL;
+
+  dbx_stats_read(dbx->options->stats, offset, size);
+
+  if (map)
+    return map + offset;
+
+  if (sys_pread(dbx->file, buffer, size, offset) != size)
+    return NULL;
+
+  return (const unsigned char *)buffer;
+}
+
+static int _dbx_read(dbx_t *dbx, unsigned long long int offset, void *buffer, size_t size)
+{
+  const unsigned char *p = _dbx_fetch(dbx, offset, size, buffer);
+  if (p == NULL)
+    return 0;
+  if (p != buffer)
+    memcpy(buffer, p, size);
+  return 1;
+}
+
+/* message filenames are allocated from a per-file arena,
+   which is released as a whole by dbx_close */
+static char *_dbx_arena_alloc(dbx_t *dbx, size_t size)
+{
+  dbx_arena_t *arena = dbx->arena;
+
+  if (arena == NULL || arena->size - arena->used < size) {
+    size_t block = (size > DBX_ARENA_BLOCK)? size : DBX_ARENA_BLOCK;
+    arena = (dbx_arena_t *)malloc(sizeof(dbx_arena_t) + block);
+    if (arena == NULL)
+      return NULL;
+    arena->size = block;
+    arena->used = 0;
+    /* keep allocating from the current block if it has more room left */
+    if (dbx->arena && dbx->arena->size - dbx->arena->used > block - size) {
+      arena->next = dbx->arena->next;
+      dbx->arena->next = arena;
+    }
+    else {
+      arena->next = dbx->arena;
+      dbx->arena = arena;
+    }
+  }
+
+  arena->used += size;
+  return (char *)(arena + 1) + arena->used - size;
+}
+
+static char *_dbx_arena_strndup(dbx_t *dbx, const char *s, size_t n, size_t extra)
+{
+  char *p = _dbx_arena_alloc(dbx, n + 1 + extra);
+  if (p) {
+    memcpy(p, s, n);
+    p[n] = '\0';
+  }
+  return p;
+}
+
+static void _dbx_arena_free(dbx_t *dbx)
+{
+  while (dbx->arena) {
+    dbx_arena_t *next = dbx->arena->next;
+    free(dbx->arena);
+    dbx->arena = next;
+  }
+}
+
+static char *_dbx_read_string(dbx_t *dbx, int offset)
 {
   char c[256] = {};
   char *s = NULL;
   int n = 0;
   int l = 0;
-
-  fseek(file, offset, SEEK_SET);
+  const unsigned char *map = _dbx_map(dbx);
+
+  if (map) {
+    const char *p = NULL;
+    if ((unsigned int)offset < dbx->file_size) {
+      const char *e = NULL;
+      p = (const char *)map + (unsigned int)offset;
+      e = memchr(p, '\0', dbx->file_size - (unsigned int)offset);
+      n = e? e - p : dbx->file_size - (unsigned int)offset;
+      dbx_stats_read(dbx->options->stats, (unsigned int)offset, n + 1);
+    }
+    s = malloc(n + 1);
+    if (n)
+      memcpy(s, p, n);
+    s[n] = '\0';
+    return s;
+  }
 
   do {
-    sys_fread(c, 1, 255, file);
+    sys_pread(dbx->file, c, 255, (unsigned int)offset + n);
+    dbx_stats_read(dbx->options->stats, (unsigned int)offset + n, 255);
     l = strlen(c);
     s = realloc(s, n + l + 1);
     memcpy(s + n, c, l);
@@ -70,66 +241,168 @@ static char *_dbx_read_string(FILE *file, int offset)
   return s;
 }
 
-static filetime_t _dbx_read_date(FILE *file, int offset)
+static filetime_t _dbx_read_date(dbx_t *dbx, int offset)
 {
-  filetime_t filetime = 0;
-  fseek(file, offset, SEEK_SET);
-  sys_fread_long_long((long long int *)&filetime, file);
-  return filetime;
+  unsigned char buffer[8];
+  const unsigned char *p = _dbx_fetch(dbx, (unsigned int)offset, 8, buffer);
+  return p? (filetime_t)sys_get_long_long(p) : 0;
 }
 
-static int _dbx_read_int(FILE *file, int offset, int value)
+static int _dbx_read_int(dbx_t *dbx, int offset, int value)
 {
   int val = value;
   if (offset) {
-    fseek(file, offset, SEEK_SET);
-    sys_fread_int(&val, file);
+    unsigned char buffer[4];
+    const unsigned char *p = _dbx_fetch(dbx, (unsigned int)offset, 4, buffer);
+    if (p)
+      val = sys_get_int(p);
   }
   return val;
 }
 
-static int _dbx_read_msg_offset(dbx_t *dbx, int msg_number)
+/* an info record, read into memory as a whole: fields that point
+   outside of it are read from the file */
+typedef struct {
+  int index;
+  int count;
+  const unsigned char *data;
+  unsigned long long int offset;
+  size_t size;
+} dbx_record_t;
+
+static const unsigned char *_dbx_record_field(dbx_record_t *record, int offset, size_t size)
 {
-  int size = 0;
-  int index = 0;
-  int value = 0;
-  unsigned char type = 0;
-  int msg_offset = 0;
-  int msg_offset_ptr = 0;
-  char count = 0;
-  int i = 0;
+  unsigned long long int pos = (unsigned int)offset;
 
-  index = dbx->info[msg_number].index;
+  if (offset == 0 || pos < record->offset || pos - record->offset > record->size ||
+      size > record->size - (pos - record->offset))
+    return NULL;
+  return record->data + (pos - record->offset);
+}
+
+static char *_dbx_record_string(dbx_t *dbx, dbx_record_t *record, int offset)
+{
+  const unsigned char *p = _dbx_record_field(record, offset, 1);
+  const unsigned char *e = NULL;
+  char *s = NULL;
 
-  fseek(dbx->file, index + 4, SEEK_SET);
-  sys_fread_int(&size, dbx->file);
-  fseek(dbx->file, 2, SEEK_CUR);
-  sys_fread(&count, 1, 1, dbx->file);
-  fseek(dbx->file, 1, SEEK_CUR);
+  if (p)
+    e = (const unsigned char *)memchr(p, '\0', record->size - (p - record->data));
+  if (e == NULL)
+    return _dbx_read_string(dbx, offset);
 
-  for (i = 0; i < count; i++) {
-    sys_fread_int((int *)&value, dbx->file);
-    type = value & 0xFF;
-    value = (value >> 8) & 0xFFFFFF;                
+  s = (char *)malloc(e - p + 1);
+  if (s)
+    memcpy(s, p, e - p + 1);
+  return s;
+}
 
-    if (type == 0x84) {
-      msg_offset = value;
-      break;
+/* copy at most size - 1 characters of the string at offset into s */
+static char *_dbx_record_string_copy(dbx_t *dbx, dbx_record_t *record, int offset, char *s, size_t size)
+{
+  const unsigned char *p = _dbx_record_field(record, offset, 1);
+  const unsigned char *e = NULL;
+
+  if (p)
+    e = (const unsigned char *)memchr(p, '\0', record->size - (p - record->data));
+  if (e) {
+    size_t n = (size_t)(e - p);
+    if (n > size - 1)
+      n = size - 1;
+    memcpy(s, p, n);
+    s[n] = '\0';
+  }
+  else {
+    char *t = _dbx_read_string(dbx, offset);
+    snprintf(s, size, "%s", t? t:"");
+    free(t);
+  }
+  return s;
+}
+
+static filetime_t _dbx_record_date(dbx_t *dbx, dbx_record_t *record, int offset)
+{
+  const unsigned char *p = _dbx_record_field(record, offset, 8);
+  return p? (filetime_t)sys_get_long_long(p) : _dbx_read_date(dbx, offset);
+}
+
+static int _dbx_record_int(dbx_t *dbx, dbx_record_t *record, int offset, int value)
+{
+  const unsigned char *p = _dbx_record_field(record, offset, 4);
+  return p? sys_get_int(p) : _dbx_read_int(dbx, offset, value);
+}
+
+/* read the info record at index: header, field descriptors and data.
+   unless the file is mapped, the record is read into *pbuffer, which
+   grows as needed */
+static void _dbx_read_record(dbx_t *dbx, int index, dbx_record_t *record,
+                             unsigned char **pbuffer, size_t *pbuffer_size)
+{
+  unsigned char header[12];
+  const unsigned char *p = NULL;
+
+  memset(record, 0, sizeof(dbx_record_t));
+  record->index = index;
+
+  p = _dbx_fetch(dbx, (unsigned int)index, 12, header);
+  if (p) {
+    const unsigned char *map = _dbx_map(dbx);
+    unsigned long long int size = 12 + (unsigned long long int)(unsigned int)sys_get_int(p + 4);
+    if (size > dbx->file_size - (unsigned int)index)
+      size = dbx->file_size - (unsigned int)index;
+    record->offset = (unsigned int)index;
+    record->size = (size_t)size;
+    dbx_stats_read(dbx->options->stats, record->offset + 12, record->size - 12);
+    if (map) {
+      record->data = map + record->offset;
     }
-    if (type == 0x04) {
-      msg_offset_ptr = index + 12 + value + 4 * count;
-      break;
+    else {
+      if (record->size > *pbuffer_size) {
+        unsigned char *buffer = (unsigned char *)realloc(*pbuffer, record->size);
+        if (buffer) {
+          *pbuffer = buffer;
+          *pbuffer_size = record->size;
+        }
+      }
+      if (record->size <= *pbuffer_size)
+        record->size = sys_pread(dbx->file, *pbuffer, record->size, record->offset);
+      else
+        record->size = 0;
+      record->data = *pbuffer;
     }
-  }
-        
-  if (msg_offset == 0 && msg_offset_ptr != 0) {
-    fseek(dbx->file, msg_offset_ptr, SEEK_SET);
-    sys_fread_int(&msg_offset, dbx->file);
+    if (record->size < 12)
+      record->size = 0;
   }
 
-  return msg_offset;
+  record->count = (record->size)? sys_get_int(record->data + 8) : 0;
+  record->count = (record->count & 0x00FF0000) >> 16;
 }
 
+/* decode the j-th field descriptor of record: return the field type,
+   or -1 on error. *poffset is set to the file offset of the field
+   value, or to 0 if the value is stored in the descriptor itself */
+static int _dbx_record_descriptor(dbx_t *dbx, dbx_record_t *record, int j, unsigned int *pvalue, int *poffset)
+{
+  unsigned char buffer[4];
+  const unsigned char *p = NULL;
+  unsigned int value = 0;
+  int type = 0;
+
+  p = _dbx_record_field(record, record->index + 12 + 4 * j, 4);
+  if (p == NULL)
+    p = _dbx_fetch(dbx, (unsigned int)record->index + 12 + 4 * j, 4, buffer);
+  if (p == NULL)
+    return -1;
+
+  value = (unsigned int)sys_get_int(p);
+  type = value & 0xFF;
+  value = (value >> 8) & 0xFFFFFF;
+
+  /* msb means direct storage */
+  *poffset = (type & 0x80)? 0:(record->index + 12 + 4 * record->count + value);
+  *pvalue = value;
+  return type;
+}
 
 static void _dbx_sanitize_filename(char *filename)
 {
@@ -145,17 +418,41 @@ static void _dbx_sanitize_filename(char *filename)
       *c = valid_char;
 }
 
-static void _dbx_set_filename(dbx_info_t *info)
+/* fields that make up message filenames */
+typedef enum {
+  DBX_NAME_SENDER_NAME,
+  DBX_NAME_SENDER_ADDRESS,
+  DBX_NAME_RECEIVER_NAME,
+  DBX_NAME_RECEIVER_ADDRESS,
+  DBX_NAME_SUBJECT,
+  DBX_NAME_LAST
+} dbx_name_field_t;
+
+static void _dbx_set_filename(dbx_t *dbx, dbx_info_t *info, dbx_record_t *record, const int *offsets)
 {
   char filename[DBX_MAX_FILENAME];
   char suffix[sizeof(".00000000.00000000.eml.00000000")];
+  char buffers[DBX_NAME_LAST][DBX_MAX_FILENAME];
+  const char *fields[DBX_NAME_LAST];
+  static const char * const defaults[DBX_NAME_LAST] = {
+    "_(no_name)_", "_(no_address)_", "_(no_name)_", "_(no_address)_", "(no_subject)"
+  };
+  int i = 0;
+
+  /* offsets[i] is -1 for missing fields */
+  for (i = 0; i < DBX_NAME_LAST; i++) {
+    if (offsets[i] < 0)
+      fields[i] = defaults[i];
+    else
+      fields[i] = _dbx_record_string_copy(dbx, record, offsets[i], buffers[i], DBX_MAX_FILENAME);
+  }
 
   snprintf(filename, DBX_MAX_FILENAME - sizeof(suffix), "%.15s_%.15s_%.15s_%.15s_%s",
-           info->sender_name? info->sender_name:"_(no_name)_",
-           info->sender_address? info->sender_address:"_(no_address)_",
-           info->receiver_name? info->receiver_name:"_(no_name)_",
-           info->receiver_address? info->receiver_address:"_(no_address)_",
-           info->subject? info->subject:"(no_subject)");
+           fields[DBX_NAME_SENDER_NAME],
+           fields[DBX_NAME_SENDER_ADDRESS],
+           fields[DBX_NAME_RECEIVER_NAME],
+           fields[DBX_NAME_RECEIVER_ADDRESS],
+           fields[DBX_NAME_SUBJECT]);
 
   sprintf(suffix, ".%08X.%08X.eml.00000000",
           (unsigned int) (info->receive_create_time & 0xFFFFFFFFULL),
@@ -164,7 +461,7 @@ static void _dbx_set_filename(dbx_info_t *info)
   
   _dbx_sanitize_filename(filename);
 
-  info->filename = strdup(filename);
+  info->filename = _dbx_arena_strndup(dbx, filename, strlen(filename), 0);
   /* remove trailing extra space (reserved for uniquification of filename) */
   info->filename[strlen(info->filename) - sizeof("00000000")] = '\0';
 }
@@ -199,153 +496,283 @@ static void _dbx_uniquify_filenames(dbx_t *dbx)
   }
 }
 
+/* decode only the fields needed to name and sync messages: all other
+   fields are decoded on demand by dbx_info_get_string/number */
 static void _dbx_read_info(dbx_t *dbx)
 {
   int i;
+  unsigned char *buffer = NULL;
+  size_t buffer_size = 0;
+  double lap = dbx_stats_clock(dbx->options->stats);
 
   for(i = 0; i < dbx->message_count; i++) {
     int j;
-    int size;
-    int count = 0;
-    int index = dbx->info[i].index;
-    int offset = 0;
-    int pos = index + 12;
+    int msg_offset_found = 0;
+    int names[DBX_NAME_LAST];
+    dbx_record_t record;
+
+    _dbx_read_record(dbx, dbx->info[i].index, &record, &buffer, &buffer_size);
 
-    fseek(dbx->file, index + 4, SEEK_SET);
-    sys_fread_int(&size, dbx->file);
-    sys_fread_int(&count, dbx->file);
-    count = (count & 0x00FF0000) >> 16;
+    for (j = 0; j < DBX_NAME_LAST; j++)
+      names[j] = -1;
 
     dbx->info[i].valid = 0;
 
-    for (j = 0; j < count; j++) {
-      int type = 0;
+    for (j = 0; j < record.count; j++) {
       unsigned int value = 0;
+      int offset = 0;
+      int type = _dbx_record_descriptor(dbx, &record, j, &value, &offset);
 
-      fseek(dbx->file, pos, SEEK_SET);
-      sys_fread_int((int*)&value, dbx->file);
-      type = value & 0xFF;
-      value = (value >> 8) & 0xFFFFFF;
+      if (type < 0)
+        break;
 
-      /* msb means direct storage */
-      offset = (type & 0x80)? 0:(index + 12 + 4 * count + value);
+      /* the message offset is given by the first message address field,
+         which is only looked for in records with less than 128 fields */
+      if (!msg_offset_found && record.count < 0x80 && (type == 0x84 || type == 0x04)) {
+        dbx->info[i].offset = (type == 0x84)? (int)value : _dbx_record_int(dbx, &record, offset, 0);
+        msg_offset_found = 1;
+      }
 
-      /* dirt ugly code follows ... */
       switch (type & 0x7f) {
-      case 0x00:
-        dbx->info[i].message_index = _dbx_read_int(dbx->file, offset, value);
-        dbx->info[i].valid |= DBX_MASK_INDEX;
-        break;
-      case 0x01:
-        dbx->info[i].flags = _dbx_read_int(dbx->file, offset, value);
-        dbx->info[i].valid |= DBX_MASK_FLAGS;
-        break;
-      case 0x02:
-        dbx->info[i].send_create_time = _dbx_read_date(dbx->file, offset);
-        break;
-      case 0x03:
-        dbx->info[i].body_lines = _dbx_read_int(dbx->file, offset, value);
-        dbx->info[i].valid |= DBX_MASK_BODYLINES;
+      case DBX_FIELD_SEND_CREATE_TIME:
+        dbx->info[i].send_create_time = _dbx_record_date(dbx, &record, offset);
         break;
-      case 0x04:
-        dbx->info[i].message_address = _dbx_read_int(dbx->file, offset, value);
-        dbx->info[i].valid |= DBX_MASK_MSGADDR;
-        break;
-      case 0x05:
-        dbx->info[i].original_subject = _dbx_read_string(dbx->file, offset);
-        break;
-      case 0x06:
-        dbx->info[i].save_time = _dbx_read_date(dbx->file, offset);
-        break;
-      case 0x07:
-        dbx->info[i].message_id = _dbx_read_string(dbx->file, offset);
-        break;
-      case 0x08:
-        dbx->info[i].subject = _dbx_read_string(dbx->file, offset);
-        break;
-      case 0x09:
-        dbx->info[i].sender_address_and_name = _dbx_read_string(dbx->file, offset);
-        break;
-      case 0x0A:
-        dbx->info[i].message_id_replied_to = _dbx_read_string(dbx->file, offset);
-        break;
-      case 0x0B:
-        dbx->info[i].server_newsgroup_message_number = _dbx_read_string(dbx->file, offset);
-        break;
-      case 0x0C:
-        dbx->info[i].server = _dbx_read_string(dbx->file, offset);
-        break;
-      case 0x0D:
-        dbx->info[i].sender_name = _dbx_read_string(dbx->file, offset);
-        break;
-      case 0x0E:
-        dbx->info[i].sender_address = _dbx_read_string(dbx->file, offset);
-        break;
-      case 0x10:
-        dbx->info[i].message_priority = _dbx_read_int(dbx->file, offset, value);
-        dbx->info[i].valid |= DBX_MASK_MSGPRIO;
-        break;
-      case 0x11:
-        dbx->info[i].message_size = _dbx_read_int(dbx->file, offset, value);
+      case DBX_FIELD_MESSAGE_SIZE:
+        dbx->info[i].message_size = _dbx_record_int(dbx, &record, offset, value);
         dbx->info[i].valid |= DBX_MASK_MSGSIZE;
         break;
-      case 0x12:
-        dbx->info[i].receive_create_time = _dbx_read_date(dbx->file, offset);
+      case DBX_FIELD_RECEIVE_CREATE_TIME:
+        dbx->info[i].receive_create_time = _dbx_record_date(dbx, &record, offset);
+        break;
+      case DBX_FIELD_SENDER_NAME:
+        names[DBX_NAME_SENDER_NAME] = offset;
         break;
-      case 0x13:
-        dbx->info[i].receiver_name = _dbx_read_string(dbx->file, offset);
+      case DBX_FIELD_SENDER_ADDRESS:
+        names[DBX_NAME_SENDER_ADDRESS] = offset;
         break;
-      case 0x14:
-        dbx->info[i].receiver_address = _dbx_read_string(dbx->file, offset);
+      case DBX_FIELD_RECEIVER_NAME:
+        names[DBX_NAME_RECEIVER_NAME] = offset;
         break;
-      case 0x1A:
-        dbx->info[i].account_name = _dbx_read_string(dbx->file, offset);
+      case DBX_FIELD_RECEIVER_ADDRESS:
+        names[DBX_NAME_RECEIVER_ADDRESS] = offset;
         break;
-      case 0x1B:
-        dbx->info[i].account_registry_key = _dbx_read_string(dbx->file, offset);
+      case DBX_FIELD_SUBJECT:
+        names[DBX_NAME_SUBJECT] = offset;
         break;
       }
-      pos += 4;
     }
 
-    dbx->info[i].offset = _dbx_read_msg_offset(dbx, i);
-    
+    lap = dbx_stats_lap(dbx->options->stats, DBX_PHASE_INFO, lap);
+
     if (dbx->options->safe_mode) {
       char filename[DBX_MAX_FILENAME];
       int msg_offset = dbx->info[i].offset;
       if (dbx->info[i].offset == 0)  /* message only in index, not downloaded yet */
         msg_offset = dbx->info[i].index;
       sprintf(filename, "%08X.eml", (unsigned int) msg_offset);
-      dbx->info[i].filename = strdup(filename);
+      /* reserve space for uniquification of filename */
+      dbx->info[i].filename = _dbx_arena_strndup(dbx, filename, strlen(filename), sizeof(".00000000") - 1);
     }
     else {
-      _dbx_set_filename(dbx->info + i);
+      _dbx_set_filename(dbx, dbx->info + i, &record, names);
+    }
+
+    lap = dbx_stats_lap(dbx->options->stats, DBX_PHASE_FILENAMES, lap);
+  }
+
+  free(buffer);
+}
+
+/* find the last field of the given type in the info record of message
+   msg_number, as that's the one that used to be decoded */
+static int _dbx_info_find(dbx_t *dbx, int msg_number, dbx_field_t field, dbx_record_t *record,
+                          unsigned char **pbuffer, size_t *pbuffer_size,
+                          unsigned int *pvalue, int *poffset)
+{
+  int found = 0;
+  int j = 0;
+
+  if (dbx == NULL || msg_number < 0 || msg_number >= dbx->message_count)
+    return 0;
+
+  _dbx_read_record(dbx, dbx->info[msg_number].index, record, pbuffer, pbuffer_size);
+
+  for (j = 0; j < record->count; j++) {
+    unsigned int value = 0;
+    int offset = 0;
+    int type = _dbx_record_descriptor(dbx, record, j, &value, &offset);
+
+    if (type < 0)
+      break;
+    if ((type & 0x7f) == field) {
+      *pvalue = value;
+      *poffset = offset;
+      found = 1;
     }
   }
+
+  return found;
 }
 
+char *dbx_info_get_string(dbx_t *dbx, int msg_number, dbx_field_t field)
+{
+  unsigned char *buffer = NULL;
+  size_t buffer_size = 0;
+  dbx_record_t record;
+  unsigned int value = 0;
+  int offset = 0;
+  char *s = NULL;
+
+  _dbx_check_size(dbx);
+  if (_dbx_info_find(dbx, msg_number, field, &record, &buffer, &buffer_size, &value, &offset))
+    s = _dbx_record_string(dbx, &record, offset);
 
-static int _dbx_read_index(dbx_t *dbx, int pos)
+  free(buffer);
+  return s;
+}
+
+int dbx_info_get_number(dbx_t *dbx, int msg_number, dbx_field_t field, unsigned long long int *pvalue)
 {
-  int i;
-  int next_table;
+  unsigned char *buffer = NULL;
+  size_t buffer_size = 0;
+  dbx_record_t record;
+  unsigned int value = 0;
+  int offset = 0;
+  int found = 0;
+
+  _dbx_check_size(dbx);
+  found = _dbx_info_find(dbx, msg_number, field, &record, &buffer, &buffer_size, &value, &offset);
+  if (found) {
+    switch (field) {
+    case DBX_FIELD_SEND_CREATE_TIME:
+    case DBX_FIELD_SAVE_TIME:
+    case DBX_FIELD_RECEIVE_CREATE_TIME:
+      *pvalue = (unsigned long long int)_dbx_record_date(dbx, &record, offset);
+      break;
+    default:
+      *pvalue = (unsigned int)_dbx_record_int(dbx, &record, offset, value);
+      break;
+    }
+  }
+
+  free(buffer);
+  return found;
+}
+
+/* index B-tree node, as read from the file */
+typedef struct {
+  const unsigned char *entries;
+  unsigned char *buffer;
+  int has_child;
+  int child;
+  int count;
+  int next;
+} dbx_index_node_t;
+
+static void _dbx_index_no_memory(dbx_t *dbx)
+{
+  dbx_progress_message(dbx->progress_handle,
+                       DBX_STATUS_ERROR,
+                       "can't read the index of DBX file %s (out of memory)",
+                       dbx->filename);
+}
+
+static void _dbx_index_corrupted(dbx_t *dbx, int pos)
+{
+  dbx_progress_message(dbx->progress_handle,
+                       DBX_STATUS_WARNING,
+                       "DBX file %s is corrupted (bad seek offset %08X)",
+                       dbx->filename,
+                       pos);
+}
+
+/* remember node position pos, return 0 if it was visited before, or -1
+   if out of memory: visited is an open addressing hash set of size
+   capacity */
+static int _dbx_index_visit(int **pvisited, int *pcapacity, int *pcount, int pos)
+{
+  unsigned int h = 0;
+  unsigned int mask = 0;
+
+  if (2 * (*pcount + 1) > *pcapacity) {
+    int capacity = (*pcapacity)? 2 * (*pcapacity) : 64;
+    int *visited = (int *)malloc(sizeof(int) * capacity);
+    int i = 0;
+
+    if (visited == NULL) {
+      perror("_dbx_index_visit (malloc)");
+      return -1;
+    }
+    memset(visited, 0, sizeof(int) * capacity);
+    mask = capacity - 1;
+    for (i = 0; i < *pcapacity; i++) {
+      if ((*pvisited)[i]) {
+        for (h = DBX_HASH_OFFSET((*pvisited)[i]) & mask; visited[h]; h = (h + 1) & mask)
+          ;
+        visited[h] = (*pvisited)[i];
+      }
+    }
+    free(*pvisited);
+    *pvisited = visited;
+    *pcapacity = capacity;
+  }
+
+  mask = *pcapacity - 1;
+  for (h = DBX_HASH_OFFSET(pos) & mask; (*pvisited)[h]; h = (h + 1) & mask) {
+    if ((*pvisited)[h] == pos)
+      return 0;
+  }
+  (*pvisited)[h] = pos;
+  (*pcount)++;
+  return 1;
+}
+
+/* read index node at pos in a single read */
+static int _dbx_read_index_node(dbx_t *dbx, int pos, dbx_index_node_t *node)
+{
+  const unsigned char *map = NULL;
+  const unsigned char *p = NULL;
   char ptr_count = 0;
-  int index_count;
+  size_t size = 0;
+
+  memset(node, 0, sizeof(dbx_index_node_t));
 
   if (pos <= 0 || dbx->file_size <= (unsigned long long int)pos) {
-    dbx_progress_message(dbx->progress_handle,
-                         DBX_STATUS_WARNING,
-                         "DBX file %s is corrupted (bad seek offset %08X)",
-                         dbx->filename,
-                         pos);
+    _dbx_index_corrupted(dbx, pos);
     return 0;
   }
 
-  fseek(dbx->file, pos + 8, SEEK_SET);
-  sys_fread_int(&next_table, dbx->file);
-  fseek(dbx->file, 5, SEEK_CUR);
-  sys_fread(&ptr_count, 1, 1, dbx->file);
+  /* a node has at most 127 entries */
+  size = 24 + 12 * 127;
+  if (dbx->file_size - pos < size)
+    size = (size_t)(dbx->file_size - pos);
+  dbx_stats_read(dbx->options->stats, (unsigned int)pos, size);
+
+  map = _dbx_map(dbx);
+  if (map) {
+    p = map + pos;
+  }
+  else {
+    node->buffer = (unsigned char *)malloc(size);
+    if (node->buffer == NULL) {
+      perror("_dbx_read_index_node (malloc)");
+      return 0;
+    }
+    size = sys_pread(dbx->file, node->buffer, size, (unsigned int)pos);
+    p = node->buffer;
+  }
+
+  if (size < 24) {
+    free(node->buffer);
+    node->buffer = NULL;
+    _dbx_index_corrupted(dbx, pos);
+    return 0;
+  }
+
+  ptr_count = (char)p[17];
   if (ptr_count <= 0) {
+    free(node->buffer);
+    node->buffer = NULL;
     dbx_progress_message(dbx->progress_handle,
                          DBX_STATUS_WARNING,
                          "DBX file %s is corrupted (bad count %d at offset %08X)",
@@ -354,266 +781,739 @@ static int _dbx_read_index(dbx_t *dbx, int pos)
                          pos + 8 + 4 + 5);
     return 0;
   }
-  fseek(dbx->file, 2, SEEK_CUR);
-  sys_fread_int(&index_count, dbx->file);
 
-  if (index_count > 0) {
-    if (!_dbx_read_index(dbx, next_table))
+  /* entries past the end of the file read as zeros */
+  if (24 + 12 * (size_t)ptr_count > size) {
+    unsigned char *buffer = (unsigned char *)calloc(24 + 12 * ptr_count, 1);
+    if (buffer == NULL) {
+      free(node->buffer);
+      node->buffer = NULL;
+      perror("_dbx_read_index_node (calloc)");
       return 0;
+    }
+    memcpy(buffer, p, size);
+    free(node->buffer);
+    node->buffer = buffer;
+    p = buffer;
   }
 
-  pos += 24;
+  node->has_child = (sys_get_int(p + 20) > 0)? 1:0;
+  node->child = sys_get_int(p + 8);
+  node->entries = p + 24;
+  node->count = ptr_count;
+  node->next = -1;
+  return 1;
+}
 
-  dbx->info = (dbx_info_t *)realloc(dbx->info, (dbx->capacity + ptr_count) * sizeof(dbx_info_t));
-  dbx->capacity += ptr_count;
-  for (i = 0; i < ptr_count; i++) {
-    int index_ptr;
-    fseek(dbx->file, pos, SEEK_SET);
-    sys_fread_int(&index_ptr, dbx->file);
-    sys_fread_int(&next_table, dbx->file);
-    sys_fread_int(&index_count, dbx->file);
+/* walk the index B-tree in order, without recursion: the stack holds
+   the path from the root to the current node, and each node is
+   visited at most once, so corrupted trees can't loop forever */
+static int _dbx_read_index(dbx_t *dbx, int root, int item_count)
+{
+  dbx_index_node_t *stack = NULL;
+  int depth = 0;
+  int stack_size = 0;
+  int *visited = NULL;
+  int visited_capacity = 0;
+  int visited_count = 0;
+  int pos = root;
+  int descend = 1;
+  int visit = 0;
+  int rc = 1;
+
+  /* each message takes at least one 12 bytes index entry */
+  if ((unsigned long long int)item_count > dbx->file_size / 12)
+    item_count = (int)(dbx->file_size / 12);
+  if (item_count > 0) {
+    dbx->info = (dbx_info_t *)malloc(item_count * sizeof(dbx_info_t));
+    dbx->capacity = dbx->info? item_count : 0;
+  }
 
+  while (1) {
+    dbx_index_node_t *node = NULL;
+    const unsigned char *entry = NULL;
+
+    if (descend) {
+      descend = 0;
+      if (depth == stack_size) {
+        dbx_index_node_t *nodes = NULL;
+        stack_size = stack_size? 2 * stack_size : 16;
+        nodes = (dbx_index_node_t *)realloc(stack, stack_size * sizeof(dbx_index_node_t));
+        if (nodes == NULL) {
+          perror("_dbx_read_index (realloc)");
+          _dbx_index_no_memory(dbx);
+          rc = 0;
+          break;
+        }
+        stack = nodes;
+      }
+      if (!_dbx_read_index_node(dbx, pos, stack + depth)) {
+        rc = 0;
+        break;
+      }
+      visit = _dbx_index_visit(&visited, &visited_capacity, &visited_count, pos);
+      if (visit <= 0) {
+        free(stack[depth].buffer);
+        if (visit < 0)
+          _dbx_index_no_memory(dbx);
+        else
+          _dbx_index_corrupted(dbx, pos);
+        rc = 0;
+        break;
+      }
+      depth++;
+    }
+
+    if (depth == 0)
+      break;
+
+    node = stack + depth - 1;
+
+    /* visit the leftmost sub-tree first */
+    if (node->next < 0) {
+      node->next = 0;
+      descend = node->has_child;
+      pos = node->child;
+      continue;
+    }
+
+    if (node->next == node->count) {
+      free(node->buffer);
+      depth--;
+      continue;
+    }
+
+    entry = node->entries + 12 * node->next;
+    node->next++;
+
+    if (dbx->message_count == dbx->capacity) {
+      dbx->capacity = dbx->capacity? 2 * dbx->capacity : 64;
+      dbx->info = (dbx_info_t *)realloc(dbx->info, dbx->capacity * sizeof(dbx_info_t));
+    }
     memset(dbx->info + dbx->message_count, 0, sizeof(dbx_info_t));
-    dbx->info[dbx->message_count].index = index_ptr;
+    dbx->info[dbx->message_count].index = sys_get_int(entry);
     dbx->message_count++;
 
-    pos += 12;
-    if (index_count > 0) {
-      if (!_dbx_read_index(dbx, next_table))
-        return 0;
-    }
+    /* then the sub-tree that follows this entry */
+    descend = (sys_get_int(entry + 8) > 0)? 1:0;
+    pos = sys_get_int(entry + 4);
   }
 
-  return 1;
+  while (depth > 0)
+    free(stack[--depth].buffer);
+  free(stack);
+  free(visited);
+
+  return rc;
 }
 
 
 static int _dbx_read_indexes(dbx_t *dbx)
 {
-  int index_ptr;
-  int item_count;
+  int index_ptr = 0;
+  int item_count = 0;
+  unsigned char buffer[4];
+  const unsigned char *p = NULL;
 
-  fseek(dbx->file, INDEX_POINTER, SEEK_SET);
-  sys_fread_int(&index_ptr, dbx->file);
+  p = _dbx_fetch(dbx, INDEX_POINTER, 4, buffer);
+  if (p)
+    index_ptr = sys_get_int(p);
 
-  fseek(dbx->file, ITEM_COUNT, SEEK_SET);
-  sys_fread_int(&item_count, dbx->file);
+  p = _dbx_fetch(dbx, ITEM_COUNT, 4, buffer);
+  if (p)
+    item_count = sys_get_int(p);
 
   if (item_count > 0)
-    return _dbx_read_index(dbx, index_ptr);
+    return _dbx_read_index(dbx, index_ptr, item_count);
   else
     return 0;
 }
 
-static dbx_chains_t *_dbx_get_scan_chains(dbx_t *dbx, long long int offset, int deleted)
+/* find the group of chains with this offset and deleted flag, or add
+   it, and return its index in scan: groups are allocated one by one, so
+   they never move, and are indexed by table, an open addressing hash
+   table of size capacity */
+static int _dbx_get_scan_chains(dbx_chains_t ***pscan, int *pscan_count,
+                                int **ptable, int *pcapacity,
+                                long long int offset, int deleted)
 {
-  int i = 0;
+  unsigned int h = 0;
+  unsigned int mask = 0;
   dbx_chains_t *scan = NULL;
-  for (i = 0; i < dbx->scan_count; i++) {
-    if (dbx->scan[i].offset == offset &&
-        dbx->scan[i].deleted == deleted) {
-      return dbx->scan + i;
+
+  if (2 * (*pscan_count + 1) > *pcapacity) {
+    int capacity = (*pcapacity)? 2 * (*pcapacity) : 64;
+    int *table = (int *)malloc(sizeof(int) * capacity);
+    int i = 0;
+
+    if (table == NULL) {
+      perror("_dbx_get_scan_chains (malloc)");
+      return -1;
     }
+    memset(table, 0xFF, sizeof(int) * capacity);
+    mask = capacity - 1;
+    for (i = 0; i < *pscan_count; i++) {
+      for (h = DBX_HASH_GROUP((*pscan)[i]->offset, (*pscan)[i]->deleted) & mask; table[h] >= 0; h = (h + 1) & mask)
+        ;
+      table[h] = i;
+    }
+    free(*ptable);
+    *ptable = table;
+    *pcapacity = capacity;
+  }
+
+  mask = *pcapacity - 1;
+  for (h = DBX_HASH_GROUP(offset, deleted) & mask; (*ptable)[h] >= 0; h = (h + 1) & mask) {
+    scan = (*pscan)[(*ptable)[h]];
+    if (scan->offset == offset && scan->deleted == deleted)
+      return (*ptable)[h];
+  }
+
+  /* the array of pointers doubles whenever its length is a power of 2 */
+  if ((*pscan_count & (*pscan_count - 1)) == 0) {
+    dbx_chains_t **groups = (dbx_chains_t **)realloc(*pscan, sizeof(dbx_chains_t *) * ((*pscan_count)? 2 * (*pscan_count) : 1));
+    if (groups == NULL) {
+      perror("_dbx_get_scan_chains (realloc)");
+      return -1;
+    }
+    *pscan = groups;
+  }
+  scan = (dbx_chains_t *)calloc(1, sizeof(dbx_chains_t));
+  if (scan == NULL) {
+    perror("_dbx_get_scan_chains (calloc)");
+    return -1;
   }
-  dbx->scan_count++;
-  dbx->scan = (dbx_chains_t *)realloc(dbx->scan, sizeof(dbx_chains_t) * dbx->scan_count);
-  scan = dbx->scan + dbx->scan_count - 1;
   scan->offset = offset;
   scan->deleted = deleted;
-  scan->fragment_count = 0;
-  scan->fragments = NULL;
-  scan->count = 0;
-  scan->chains = NULL;
-  return scan;
+  (*ptable)[h] = *pscan_count;
+  (*pscan)[*pscan_count] = scan;
+  return (*pscan_count)++;
 }
 
-static void _dbx_scan(dbx_t *dbx)
+static dbx_fragment_t *_dbx_add_fragments(dbx_chains_t *chains, const dbx_fragment_t *fragments, int n)
 {
-  int header[8] = {0};
-  int header_start = 0;
-  int ready = 0;
-  unsigned long long int i = 0;
+  int capacity = (chains->fragment_count + DBX_SCAN_FRAGMENTS - 1) / DBX_SCAN_FRAGMENTS * DBX_SCAN_FRAGMENTS;
+  dbx_fragment_t *fragment = NULL;
+
+  if (chains->fragment_count + n > capacity) {
+    capacity = (chains->fragment_count + n + DBX_SCAN_FRAGMENTS - 1) / DBX_SCAN_FRAGMENTS * DBX_SCAN_FRAGMENTS;
+    chains->fragments = (dbx_fragment_t *)realloc(chains->fragments, sizeof(dbx_fragment_t) * capacity);
+  }
+
+  fragment = chains->fragments + chains->fragment_count;
+  memcpy(fragment, fragments, sizeof(dbx_fragment_t) * n);
+  chains->fragment_count += n;
+  chains->count += n;
+  return fragment;
+}
+
+/* return size bytes of the file at offset, zero padded past its end:
+   unmapped files are read in whole DBX_SCAN_ALIGN blocks, as required for
+   direct I/O, so buffer must be aligned and have room for 2 extra blocks */
+static const unsigned char *_dbx_scan_window(dbx_scan_t *scan, unsigned long long int offset, size_t size, unsigned char *buffer)
+{
+  unsigned long long int file_size = scan->dbx->file_size;
+  size_t n = 0;
+
+  if (offset < file_size)
+    n = (file_size - offset < size)? (size_t)(file_size - offset) : size;
+  if (n)
+    dbx_stats_read(scan->dbx->options->stats, offset, n);
+
+  if (scan->map) {
+    if (n == size)
+      return scan->map + offset;
+    if (n)
+      memcpy(buffer, scan->map + offset, n);
+  }
+  else if (n) {
+    unsigned long long int aligned = offset / DBX_SCAN_ALIGN * DBX_SCAN_ALIGN;
+    size_t skip = (size_t)(offset - aligned);
+    size_t length = (skip + n + DBX_SCAN_ALIGN - 1) / DBX_SCAN_ALIGN * DBX_SCAN_ALIGN;
+
+    n = sys_pread(scan->file, buffer, length, aligned);
+    n = (n > skip)? n - skip : 0;
+    if (n > size)
+      n = size;
+    buffer += skip;
+  }
+
+  memset(buffer + n, 0, size - n);
+  return buffer;
+}
+
+/* fragment header candidate filter:
+   return index of the first of n little-endian words at p that equals
+   0x200 or 0x1FC (2nd word of a fragment header), or n if there is none */
+static size_t _dbx_scan_marker(const unsigned char *p, size_t n)
+{
+  size_t i = 0;
+
+  for (i = 0; i < n; i++) {
+    int word = sys_get_int(p + 4 * i);
+    if (word == 0x200 || word == 0x1FC)
+      break;
+  }
+  return i;
+}
+
+#ifdef DBX_SCAN_X86
+__attribute__((target("sse2")))
+static size_t _dbx_scan_marker_sse2(const unsigned char *p, size_t n)
+{
+  const __m128i live = _mm_set1_epi32(0x200);
+  const __m128i deleted = _mm_set1_epi32(0x1FC);
+  size_t i = 0;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    __m128i words = _mm_loadu_si128((const __m128i *)(p + 4 * i));
+    int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi32(words, live),
+                                              _mm_cmpeq_epi32(words, deleted)));
+    if (mask)
+      return i + (__builtin_ctz(mask) >> 2);
+  }
+  return i + _dbx_scan_marker(p + 4 * i, n - i);
+}
+
+__attribute__((target("avx2")))
+static size_t _dbx_scan_marker_avx2(const unsigned char *p, size_t n)
+{
+  const __m256i live = _mm256_set1_epi32(0x200);
+  const __m256i deleted = _mm256_set1_epi32(0x1FC);
+  size_t i = 0;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    __m256i words = _mm256_loadu_si256((const __m256i *)(p + 4 * i));
+    unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi32(words, live),
+                                                                           _mm256_cmpeq_epi32(words, deleted)));
+    if (mask)
+      return i + (__builtin_ctz(mask) >> 2);
+  }
+  return i + _dbx_scan_marker(p + 4 * i, n - i);
+}
+#endif
+
+/* pick the widest candidate filter supported by this CPU */
+static dbx_scan_marker_t _dbx_scan_marker_select(void)
+{
+#ifdef DBX_SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return _dbx_scan_marker_avx2;
+  if (__builtin_cpu_supports("sse2"))
+    return _dbx_scan_marker_sse2;
+#endif
+  return _dbx_scan_marker;
+}
+
+/* check for a fragment header at file offset pos */
+static int _dbx_scan_header(dbx_t *dbx, const unsigned char *p, unsigned long long int pos,
+                            dbx_fragment_t *fragment, long long int *offset, int *deleted)
+{
+  int header[5];
   int j = 0;
-  
-  dbx_progress_push(dbx->progress_handle, DBX_VERBOSITY_INFO, dbx->file_size, "Scanning %s", dbx->filename);
 
-  for (i = 0; i < dbx->file_size; i += 4) {
-    int deleted = 0;
-    dbx_chains_t *chains = NULL;
-    dbx_fragment_t *other = NULL;
-    dbx_fragment_t *fragment = NULL;
-
-    dbx_progress_update(dbx->progress_handle, DBX_STATUS_OK, i, NULL);
-
-    /* initialize header buffer */
-    if (!ready) {
-      header_start = 0;
-      for (j = 0; j < 4; j++)
-        sys_fread_int(header + j, dbx->file);
-      i += 16;
-      ready = 1;
-    }
-
-    sys_fread_int(header + ((header_start + 4) & 7), dbx->file);
-
-    /* message fragment header signature:
-       =================================
-       1st word value equals offset into file 
-       2nd word is 0x200
-       3rd word is fragment length: must be positive, but not more than 0x200 
-       4th word value is the file offset of the next fragment, or 0 if last
-
-       deleted message fragment header signature:
-       =========================================
-       1st word value equals offset into file
-       2nd word is 0x1FC
-       3rd word is 0x210
-       4th word value is offset of next fragment or 0 if last
-       5th word value is offset of previous fragment (clobbering message data!)
-
-       sanity: we check that all offsets are less than file size,
-       and are a multiple of 4 and that fragment does not point to itself
-    */
+  for (j = 0; j < 5; j++)
+    header[j] = sys_get_int(p + 4 * j);
+
+  /* message fragment header signature:
+     =================================
+     1st word value equals offset into file 
+     2nd word is 0x200
+     3rd word is fragment length: must be positive, but not more than 0x200 
+     4th word value is the file offset of the next fragment, or 0 if last
+
+     deleted message fragment header signature:
+     =========================================
+     1st word value equals offset into file
+     2nd word is 0x1FC
+     3rd word is 0x210
+     4th word value is offset of next fragment or 0 if last
+     5th word value is offset of previous fragment (clobbering message data!)
+
+     sanity: we check that all offsets are less than file size,
+     and are a multiple of 4 and that fragment does not point to itself
+  */
 
-    int header_offset_diff = header[header_start] - i;
-    int message_fragment_found = (header[(header_start + 1) & 7] == 0x200 &&
-                                  header[(header_start + 2) & 7] > 0 &&
-                                  header[(header_start + 2) & 7] <= 0x200 &&
-                                  header[(header_start + 3) & 7] >= 0 &&
-                                  header[(header_start + 3) & 7] < dbx->file_size &&
-                                  (header[(header_start + 3) & 7] & 3) == 0 &&
-                                  header[(header_start + 3) & 7] != header[header_start])? 1:0;
-    int deleted_fragment_found = (header[(header_start + 1) & 7] == 0x1FC &&
-                                  header[(header_start + 2) & 7] == 0x210 &&
-                                  header[(header_start + 3) & 7] < dbx->file_size &&
-                                  (header[(header_start + 3) & 7] & 3) == 0 &&
-                                  header[(header_start + 3) & 7] != header[header_start] &&
-                                  header[(header_start + 4) & 7] >= 0 &&
-                                  header[(header_start + 4) & 7] < dbx->file_size &&
-                                  (header[(header_start + 4) & 7] & 3) == 0)? 1:0;
+  int header_offset_diff = header[0] - pos;
+  int message_fragment_found = (header[1] == 0x200 &&
+                                header[2] > 0 &&
+                                header[2] <= 0x200 &&
+                                header[3] >= 0 &&
+                                header[3] < dbx->file_size &&
+                                (header[3] & 3) == 0 &&
+                                header[3] != header[0])? 1:0;
+  int deleted_fragment_found = (header[1] == 0x1FC &&
+                                header[2] == 0x210 &&
+                                header[3] < dbx->file_size &&
+                                (header[3] & 3) == 0 &&
+                                header[3] != header[0] &&
+                                header[4] >= 0 &&
+                                header[4] < dbx->file_size &&
+                                (header[4] & 3) == 0)? 1:0;
     
-    if (!message_fragment_found &&
-        !deleted_fragment_found) {
-      header_start = (header_start + 1) & 7;
+  if (!message_fragment_found &&
+      !deleted_fragment_found)
+    return 0;
+
+  fragment->prev = -1;
+  fragment->next = -1;
+  fragment->offset = header[0];
+  fragment->offset_next = header[3];
+  fragment->offset_prev = header[4]; /* only valid for deleted messages */
+  fragment->size = header[2];
+  *offset = header_offset_diff;
+  *deleted = (header[1] == 0x1FC)? 1:0;
+  return 1;
+}
+
+static void _dbx_scan_range(void *arg, int irange)
+{
+  dbx_scan_t *scan = (dbx_scan_t *)arg;
+  dbx_scan_range_t *range = scan->ranges + irange;
+  dbx_t *dbx = scan->dbx;
+  unsigned char *buffer = NULL;
+  const unsigned char *window = NULL;
+  unsigned long long int window_offset = 0;
+  unsigned long long int reported = range->start;
+  unsigned long long int i = range->start;
+  size_t block = DBX_SCAN_BLOCK;
+
+  /* don't allocate more than this range needs */
+  if (range->end - range->start < block)
+    block = (size_t)((range->end - range->start + DBX_SCAN_ALIGN - 1) / DBX_SCAN_ALIGN * DBX_SCAN_ALIGN);
+
+  buffer = (unsigned char *)sys_aligned_alloc(DBX_SCAN_ALIGN, block + DBX_SCAN_HEADER + 2 * DBX_SCAN_ALIGN);
+  if (buffer == NULL) {
+    perror("_dbx_scan_range (malloc)");
+    return;
+  }
+
+  while (i < range->end) {
+    long long int offset = 0;
+    int deleted = 0;
+    int ichains = 0;
+    dbx_fragment_t fragment;
+
+    if (window == NULL || i >= window_offset + block) {
+      if (window) {
+        dbx_progress_add(dbx->progress_handle, i - reported, 0);
+        reported = i;
+      }
+      window_offset = i;
+      window = _dbx_scan_window(scan, window_offset, block + DBX_SCAN_HEADER, buffer);
+    }
+
+    {
+      /* skip ahead to the next position whose 2nd word looks like a
+         fragment header marker, and validate only that position */
+      unsigned long long int limit = window_offset + block;
+      size_t n = 0;
+      size_t k = 0;
+
+      if (limit > range->end)
+        limit = range->end;
+      n = (size_t)((limit - i + 3) / 4);
+      k = scan->find_marker(window + (i - window_offset) + 4, n);
+      i += 4 * (unsigned long long int)k;
+      if (k == n)
+        continue;
+    }
+
+    if (!_dbx_scan_header(dbx, window + (i - window_offset), i, &fragment, &offset, &deleted)) {
+      i += 4;
       continue;
     }
 
-    if (dbx->options->debug) {
-      int iii;
-      for (iii = 0; iii < 5; iii++) {
-        printf("%08X ", header[(header_start + iii) & 7]);
-      }
-      printf("\n");
+    /* add fragment to this range's fragment lists */
+    ichains = _dbx_get_scan_chains(&range->scan, &range->scan_count,
+                                   &range->scan_table, &range->scan_capacity,
+                                   offset, deleted);
+    if (ichains < 0)
+      break;
+    _dbx_add_fragments(range->scan[ichains], &fragment, 1);
+
+    if ((range->hit_count % DBX_SCAN_FRAGMENTS) == 0)
+      range->hits = (dbx_scan_hit_t *)realloc(range->hits,
+                                              sizeof(dbx_scan_hit_t) * (range->hit_count + DBX_SCAN_FRAGMENTS));
+    range->hits[range->hit_count].position = i;
+    range->hits[range->hit_count].chains = ichains;
+    range->hit_count++;
+
+    /* skip contents of fragment */
+    i += 0x210;
+  }
+
+  range->resume = i;
+
+  dbx_progress_add(dbx->progress_handle, ((range->end < i)? range->end : i) - reported, 0);
+
+  sys_aligned_free(buffer);
+}
+
+/* append fragment to its chains, linking it to the fragment that was
+   previously added to the same chains, if it's the previous or next
+   fragment in the same chain */
+static void _dbx_scan_add(dbx_scan_t *scan, const dbx_fragment_t *f, long long int offset, int deleted)
+{
+  dbx_t *dbx = scan->dbx;
+  dbx_chains_t *chains = NULL;
+  int ichains = 0;
+  dbx_fragment_t *other = NULL;
+  dbx_fragment_t *fragment = NULL;
+
+  if (dbx->options->debug) {
+    printf("%08X %08X %08X %08X %08X \n",
+           f->offset, deleted? 0x1FC:0x200, f->size, f->offset_next, f->offset_prev);
+  }
+
+  ichains = _dbx_get_scan_chains(&dbx->scan, &dbx->scan_count,
+                                 &scan->scan_table, &scan->scan_capacity,
+                                 offset, deleted);
+  if (ichains < 0)
+    return;
+  chains = dbx->scan[ichains];
+  fragment = _dbx_add_fragments(chains, f, 1);
+
+  /* check if previous fragment is next fragment, if we already passed it */
+  other = fragment - 1;
+  if (other >= chains->fragments) {
+    if (fragment->offset_next &&
+        fragment->offset_next < fragment->offset &&
+        other->prev < 0 && /* avoid already used fragments */
+        fragment->offset_next == other->offset &&
+        (!deleted || other->offset_prev == fragment->offset)) {
+      fragment->next = other - chains->fragments;
+      other->prev = chains->fragment_count - 1;
+      chains->count--;
     }
-    
-    /* add fragment to fragment list */
-    deleted = (header[(header_start + 1) & 7] == 0x1FC)? 1:0;
-    chains = _dbx_get_scan_chains(dbx, header_offset_diff, deleted);
-
-    if ((chains->fragment_count % 4096) == 0)
-      chains->fragments = (dbx_fragment_t *)realloc(chains->fragments,
-                                                    sizeof(dbx_fragment_t) * (chains->fragment_count + 4096));
-
-
-    fragment = chains->fragments + chains->fragment_count;
-    fragment->prev = -1;
-    fragment->next = -1;
-    fragment->offset = header[header_start];
-    fragment->offset_next = header[(header_start + 3) & 7];
-    fragment->offset_prev = header[(header_start + 4) & 7]; /* only valid for deleted messages */
-    fragment->size = header[(header_start + 2) & 7];
-    chains->fragment_count++;
-    chains->count++;
-
-    /* check if previous fragment is next fragment, if we already passed it */
-    other = fragment - 1;
-    if (other >= chains->fragments) {
-      if (fragment->offset_next &&
-          fragment->offset_next < fragment->offset &&
-          other->prev < 0 && /* avoid already used fragments */
-          fragment->offset_next == other->offset &&
-          (!deleted || other->offset_prev == fragment->offset)) {
-        fragment->next = other - chains->fragments;
-        other->prev = chains->fragment_count - 1;
-        chains->count--;
+    else if (other->next < 0 &&
+             fragment->offset == other->offset_next &&
+             (!deleted || fragment->offset_prev == other->offset)) {
+      fragment->prev = other - chains->fragments;
+      other->next = chains->fragment_count - 1;
+      chains->count--;
+    }
+  }
+}
+
+/* link each fragment that was not linked during the scan to the
+   fragment at its next offset, found via an offset hash table */
+static void _dbx_link_fragments(dbx_chains_t *chains)
+{
+  unsigned int size = 1;
+  unsigned int mask = 0;
+  unsigned int h = 0;
+  int *table = NULL;
+  int i = 0;
+
+  while (size < 2 * (unsigned int)chains->fragment_count)
+    size <<= 1;
+  mask = size - 1;
+
+  table = (int *)malloc(sizeof(int) * size);
+  if (table == NULL) {
+    perror("_dbx_link_fragments (malloc)");
+    return;
+  }
+  memset(table, 0xFF, sizeof(int) * size);
+
+  /* fragment offsets are unique within a group */
+  for (i = 0; i < chains->fragment_count; i++) {
+    for (h = DBX_HASH_OFFSET(chains->fragments[i].offset) & mask; table[h] >= 0; h = (h + 1) & mask)
+      ;
+    table[h] = i;
+  }
+
+  for (i = 0; i < chains->fragment_count; i++) {
+    dbx_fragment_t *fragment = chains->fragments + i;
+    dbx_fragment_t *other = NULL;
+
+    if (fragment->offset_next == 0 || fragment->next >= 0)
+      continue;
+
+    for (h = DBX_HASH_OFFSET(fragment->offset_next) & mask; table[h] >= 0; h = (h + 1) & mask) {
+      if (chains->fragments[table[h]].offset == fragment->offset_next)
+        break;
+    }
+    if (table[h] < 0)
+      continue;
+
+    other = chains->fragments + table[h];
+    if (other->prev >= 0)
+      continue;
+    if (chains->deleted && other->offset_prev != fragment->offset)
+      continue;
+    fragment->next = table[h];
+    other->prev = i;
+    chains->count--;
+  }
+
+  free(table);
+}
+
+/* merge fragments found by range scans, in file order, as if the
+   whole file was scanned serially: a fragment found near the end of
+   one range may extend into the next range, in which case the next
+   range's results are only valid from the first position that its
+   scan shares with the serial scan */
+static void _dbx_scan_merge(dbx_scan_t *scan)
+{
+  dbx_t *dbx = scan->dbx;
+  unsigned char *buffer = NULL;
+  unsigned long long int i = DBX_SCAN_START;
+  int *first = NULL;
+  int *index = NULL;
+  int k = 0;
+  int j = 0;
+
+  buffer = (unsigned char *)sys_aligned_alloc(DBX_SCAN_ALIGN, DBX_SCAN_HEADER + 2 * DBX_SCAN_ALIGN);
+  if (buffer == NULL) {
+    perror("_dbx_scan_merge (malloc)");
+    return;
+  }
+
+  for (k = 0; k < scan->range_count; k++) {
+    dbx_scan_range_t *range = scan->ranges + k;
+    int ihit = 0;
+
+    while (i < range->end) {
+      long long int offset = 0;
+      int deleted = 0;
+      dbx_fragment_t fragment;
+
+      while (ihit < range->hit_count && range->hits[ihit].position + 0x210 <= i)
+        ihit++;
+      /* i was also checked by the range scan */
+      if (ihit == range->hit_count || range->hits[ihit].position >= i)
+        break;
+      /* i is inside a fragment that the range scan skipped */
+      if (_dbx_scan_header(dbx, _dbx_scan_window(scan, i, DBX_SCAN_HEADER, buffer), i, &fragment, &offset, &deleted)) {
+        _dbx_scan_add(scan, &fragment, offset, deleted);
+        i += 0x210;
       }
-      else if (other->next < 0 &&
-               fragment->offset == other->offset_next &&
-               (!deleted || fragment->offset_prev == other->offset)) {
-        fragment->prev = other - chains->fragments;
-        other->next = chains->fragment_count - 1;
-        chains->count--;
+      else {
+        i += 4;
       }
     }
 
-    /* skip contents of fragment */
-    i += 0x200 - 4;
-    fseek(dbx->file, i + 20, SEEK_SET);
-    /* header buffer should be refilled */
-    ready = 0;
+    if (i >= range->end)
+      continue;
+
+    /* add range fragments from position i on, in file order */
+    first = (int *)calloc(range->scan_count, sizeof(int));
+    index = (int *)calloc(range->scan_count, sizeof(int));
+    for (j = 0; j < ihit; j++)
+      first[range->hits[j].chains]++;
+    for (j = ihit; j < range->hit_count; j++) {
+      dbx_scan_hit_t *hit = range->hits + j;
+      dbx_chains_t *chains = range->scan[hit->chains];
+      _dbx_scan_add(scan, chains->fragments + first[hit->chains] + index[hit->chains], chains->offset, chains->deleted);
+      index[hit->chains]++;
+    }
+    free(index);
+    free(first);
+
+    i = range->resume;
   }
 
-  for (j = 0; j < dbx->scan_count; j++) {
-    if (dbx->scan[j].count) {
-      dbx_chains_t *chains = NULL;
-      dbx_fragment_t *other = NULL;
-      dbx_fragment_t *fragment = NULL;
-      unsigned int k0, k1, k2;
-
-      chains = &dbx->scan[j];
-      for (i = 0; i < chains->fragment_count; i++) {
-        fragment = chains->fragments + i;
-        if (fragment->offset_next == 0 || fragment->next >= 0)
-          continue;
-
-        k0 = 0;
-        k2 = chains->fragment_count;
-        for (k1 = i + (i < k2)? 1:0;  k0 < k2;  k1 = (k0 + k2) / 2) {
-          other = chains->fragments + k1;
-          if (other->offset < fragment->offset_next) {
-            if (k1 == k0)
-              break;
-            k0 = k1;
-            continue;
-          }
-          if (other->offset > fragment->offset_next) {
-            k2 = k1;
-            continue;
-          }
-          if (other->prev >= 0)
-            break;
-          if (dbx->scan[j].deleted && other->offset_prev != fragment->offset)
-            break;
-          fragment->next = k1;
-          other->prev = i;
-          chains->count--;
-          break;
-        }
-      }
+  sys_aligned_free(buffer);
+}
+
+static void _dbx_scan(dbx_t *dbx)
+{
+  int j = 0;
+  unsigned long long int i = 0;
+  unsigned long long int range_size = 0;
+  dbx_scan_t scan;
+  
+  dbx_progress_push(dbx->progress_handle, DBX_VERBOSITY_INFO, dbx->file_size, "Scanning %s", dbx->filename);
+
+  /* split the file into ranges that are scanned concurrently:
+     a few ranges per thread keep all threads busy till the end */
+  memset(&scan, 0, sizeof(scan));
+  scan.dbx = dbx;
+  scan.find_marker = _dbx_scan_marker_select();
+  scan.file = dbx->file;
+  scan.map = dbx->map;
+  if (dbx->options->direct_io) {
+    /* bypass the OS cache: read the file in aligned blocks */
+    scan.file = sys_fopen_direct(dbx->filename);
+    scan.map = NULL;
+    if (scan.file == NULL) {
+      dbx_progress_message(dbx->progress_handle,
+                           DBX_STATUS_WARNING,
+                           "direct I/O is not available for %s",
+                           dbx->filename);
+      scan.file = dbx->file;
+      scan.map = dbx->map;
     }
   }
+  if (scan.file == dbx->file)
+    sys_advise_sequential(scan.file, (void *)scan.map, dbx->file_size, 1);
+
+  range_size = dbx->file_size;
+  if (dbx->options->threads > 1)
+    range_size = dbx->file_size / (dbx->options->threads * DBX_SCAN_RANGES_PER_THREAD);
+  range_size = (range_size + DBX_SCAN_ALIGN - 1) / DBX_SCAN_ALIGN * DBX_SCAN_ALIGN;
+  if (range_size == 0)
+    range_size = DBX_SCAN_ALIGN;
+  for (i = DBX_SCAN_START; i < dbx->file_size; i += range_size) {
+    scan.ranges = (dbx_scan_range_t *)realloc(scan.ranges, sizeof(dbx_scan_range_t) * (scan.range_count + 1));
+    memset(scan.ranges + scan.range_count, 0, sizeof(dbx_scan_range_t));
+    scan.ranges[scan.range_count].start = i;
+    scan.ranges[scan.range_count].end = (dbx->file_size - i > range_size)? i + range_size : dbx->file_size;
+    scan.range_count++;
+  }
+
+  sys_parallel(dbx->options->threads, scan.range_count, _dbx_scan_range, &scan);
+  _dbx_scan_merge(&scan);
+
+  for (j = 0; j < scan.range_count; j++) {
+    int k = 0;
+    for (k = 0; k < scan.ranges[j].scan_count; k++) {
+      free(scan.ranges[j].scan[k]->fragments);
+      free(scan.ranges[j].scan[k]);
+    }
+    free(scan.ranges[j].scan);
+    free(scan.ranges[j].scan_table);
+    free(scan.ranges[j].hits);
+  }
+  free(scan.ranges);
+  free(scan.scan_table);
+
+  /* messages are read in chain order, not in file order */
+  if (scan.file == dbx->file)
+    sys_advise_sequential(scan.file, (void *)scan.map, dbx->file_size, 0);
+  else
+    fclose(scan.file);
+
+  for (j = 0; j < dbx->scan_count; j++) {
+    if (dbx->scan[j]->count)
+      _dbx_link_fragments(dbx->scan[j]);
+  }
 
   /* collect the fragments that start messages chains
      messages start with fragments where prev == -1,
      i.e. no other fragment points to it
   */
   for (j = 0; j < dbx->scan_count; j++) {
-    if (dbx->scan[j].count) {
+    if (dbx->scan[j]->count) {
       int nm = 0;
       int nf = 0;
       int cnf = 0;
       dbx_fragment_t *pf = NULL;
 
-      dbx->scan[j].chains = (dbx_fragment_t **)calloc(dbx->scan[j].count, sizeof(dbx_fragment_t *));
-      dbx->scan[j].chain_fragment_count = (int *)calloc(dbx->scan[j].count, sizeof(int));
-      for (nm = 0; nm < dbx->scan[j].count; nm++) {
-        while (dbx->scan[j].fragments[nf].prev >= 0)
+      dbx->scan[j]->chains = (dbx_fragment_t **)calloc(dbx->scan[j]->count, sizeof(dbx_fragment_t *));
+      dbx->scan[j]->chain_fragment_count = (int *)calloc(dbx->scan[j]->count, sizeof(int));
+      for (nm = 0; nm < dbx->scan[j]->count; nm++) {
+        while (dbx->scan[j]->fragments[nf].prev >= 0)
           nf++;
-        dbx->scan[j].chains[nm] = dbx->scan[j].fragments + nf;
+        dbx->scan[j]->chains[nm] = dbx->scan[j]->fragments + nf;
         /* count fragments in chain */
-        for (cnf = nf, pf = dbx->scan[j].chains[nm]; cnf >= 0; cnf = pf->next) {
-          dbx->scan[j].chain_fragment_count[nm]++;
-          pf = dbx->scan[j].fragments + cnf;
+        for (cnf = nf, pf = dbx->scan[j]->chains[nm]; cnf >= 0; cnf = pf->next) {
+          dbx->scan[j]->chain_fragment_count[nm]++;
+          pf = dbx->scan[j]->fragments + cnf;
         }
         nf++;
       }
@@ -658,14 +1558,20 @@ static void _dbx_init(dbx_t *dbx)
 
   if (dbx->options->recover) {
     /* we ignore file type in recovery mode */
+    double start = dbx_stats_clock(dbx->options->stats);
     _dbx_scan(dbx);
+    dbx_stats_lap(dbx->options->stats, DBX_PHASE_SCAN, start);
   }
   else if (dbx->type == DBX_TYPE_EMAIL) {
+    double start = dbx_stats_clock(dbx->options->stats);
     _dbx_read_indexes(dbx);
+    dbx_stats_lap(dbx->options->stats, DBX_PHASE_INDEX, start);
     _dbx_read_info(dbx);
+    start = dbx_stats_clock(dbx->options->stats);
     qsort(dbx->info, dbx->message_count, sizeof(dbx_info_t), (dbx_cmpfunc_t) _dbx_info_cmp);
     if (!dbx->options->safe_mode) /* filenames should already be unique in safe mode */
       _dbx_uniquify_filenames(dbx);
+    dbx_stats_lap(dbx->options->stats, DBX_PHASE_FILENAMES, start);
   }
 }
 
@@ -676,20 +1582,25 @@ dbx_t *dbx_open(char *filename, dbx_options_t *options)
 
   if (dbx) {
     dbx->progress_handle = dbx_progress_new(options->verbosity);
+    /* keep output of concurrent extractions apart */
+    dbx_progress_set_buffered(dbx->progress_handle, options->jobs > 1);
+    dbx_progress_set_name(dbx->progress_handle, filename);
     dbx->file = fopen(filename, "rb");
     if (dbx->file == NULL) {
-      free(dbx);
+      dbx_close(dbx);
       dbx = NULL;
     }
     else {
       struct stat st;
       if (stat(filename, &st) != 0) {
         perror("dbx_open");
+        dbx_close(dbx);
         dbx = NULL;
       }
       else {
         dbx->filename = strdup(filename);
-        dbx->file_size = sys_filesize(".", filename);
+        dbx->file_size = st.st_size;
+        dbx->map = (unsigned char *)sys_mmap(dbx->file, dbx->file_size);
         dbx->options = options;
         _dbx_init(dbx);
       }
@@ -699,52 +1610,65 @@ dbx_t *dbx_open(char *filename, dbx_options_t *options)
   return dbx;
 }
 
+/* FNV-1a digest of the file header, which holds the item count, the
+   index pointers and the other counters that change with the file */
+int dbx_header_digest(char *filename, unsigned long long int *digest)
+{
+  FILE *file = NULL;
+  unsigned char *header = NULL;
+  size_t size = 0;
+  size_t i = 0;
+
+  header = (unsigned char *)malloc(HEADER_SIZE);
+  if (header == NULL)
+    return -1;
+
+  file = fopen(filename, "rb");
+  if (file == NULL) {
+    free(header);
+    return -1;
+  }
+
+  size = fread(header, 1, HEADER_SIZE, file);
+  fclose(file);
+
+  *digest = 0xCBF29CE484222325ULL ^ size;
+  for (i = 0; i < size; i++) {
+    *digest ^= header[i];
+    *digest *= 0x100000001B3ULL;
+  }
+
+  free(header);
+  return 0;
+}
+
 void dbx_close(dbx_t *dbx)
 {
   int i;
 
   if (dbx) {
+    if (dbx->map) {
+      sys_munmap(dbx->map, dbx->file_size);
+      dbx->map = NULL;
+    }
+
     if (dbx->file) {
       fclose(dbx->file);
       dbx->file = NULL;
     }
 
-    for(i = 0; i < dbx->message_count; i++) {
-      free(dbx->info[i].filename);
-      free(dbx->info[i].original_subject);
-      free(dbx->info[i].message_id);
-      free(dbx->info[i].subject);
-      free(dbx->info[i].sender_address_and_name);
-      free(dbx->info[i].message_id_replied_to);
-      free(dbx->info[i].server_newsgroup_message_number);
-      free(dbx->info[i].server);
-      free(dbx->info[i].sender_name);
-      free(dbx->info[i].sender_address);
-      free(dbx->info[i].receiver_name);
-      free(dbx->info[i].receiver_address);
-      free(dbx->info[i].account_name);
-      free(dbx->info[i].account_registry_key);
-    }
+    /* message filenames */
+    _dbx_arena_free(dbx);
 
     free(dbx->info);
     dbx->info = NULL;
     free(dbx->filename);
 
     for (i = 0; i < dbx->scan_count; i++) {
-      if (dbx->scan[i].chains) {
-        free(dbx->scan[i].chains);
-        dbx->scan[i].chains = NULL;
-        dbx->scan[i].count = 0;
-      }
-      if (dbx->scan[i].chain_fragment_count) {
-        free(dbx->scan[i].chain_fragment_count);
-        dbx->scan[i].chain_fragment_count = NULL;
-      }
-      if (dbx->scan[i].fragments) {
-        free(dbx->scan[i].fragments);
-        dbx->scan[i].fragments = NULL;
-        dbx->scan[i].fragment_count = 0;
-      }
+      free(dbx->scan[i]->chains);
+      free(dbx->scan[i]->chain_fragment_count);
+      free(dbx->scan[i]->fragments);
+      free(dbx->scan[i]);
     }
     if (dbx->scan) {
       free(dbx->scan);
@@ -757,49 +1681,176 @@ void dbx_close(dbx_t *dbx)
   }
 }
 
-char *dbx_message(dbx_t *dbx, int msg_number, unsigned int *psize)
+static const char _dbx_zeros[0x200];
+
+/* collect the file ranges of up to max blocks of a message, starting
+   with the block at *pblock. *pblock is set to the next block, or to 0
+   at the end of the chain, and *ptotal accumulates the message size.
+   data is set if the caller is going to read the ranges */
+static int _dbx_message_blocks(dbx_t *dbx, int *pblock, unsigned int *ptotal,
+                               sys_range_t *ranges, int max, int warn, int data)
 {
+  const unsigned char *map = _dbx_map(dbx);
+  int n = 0;
+
+  while (*pblock != 0 && n < max) {
+    unsigned char header[16];
+    const unsigned char *p = _dbx_fetch(dbx, (unsigned int)*pblock, 16, header);
+    short block_size = p? sys_get_short(p + 8) : 0;
+    unsigned long long int block_offset = (unsigned int)*pblock + 16;
+
+    if (block_size <= 0 || block_size > 0x200 || *ptotal + block_size > dbx->file_size) {
+      if (warn)
+        dbx_progress_message(dbx->progress_handle,
+                             DBX_STATUS_WARNING,
+                             "DBX file %s is corrupted (bad block size %04X at offset %08X)",
+                             dbx->filename,
+                             block_size,
+                             *pblock + 8);
+      *pblock = 0;
+      break;
+    }
+
+    ranges[n].offset = block_offset;
+    ranges[n].size = block_size;
+    ranges[n].data = NULL;
+    if (block_offset > dbx->file_size || block_size > dbx->file_size - block_offset)
+      ranges[n].data = _dbx_zeros;  /* block data past the end of the file */
+    else if (map)
+      ranges[n].data = map + block_offset;
+    if (data && ranges[n].data != _dbx_zeros)
+      dbx_stats_read(dbx->options->stats, block_offset, block_size);
+    n++;
+
+    *ptotal += block_size;
+    *pblock = sys_get_int(p + 12);
+  }
+
+  return n;
+}
+
+unsigned int dbx_message_size(dbx_t *dbx, int msg_number)
+{
+  sys_range_t ranges[DBX_MESSAGE_BLOCKS];
   unsigned int total_size = 0;
-  short block_size = 0;
-  int i = 0;
-  char *buf = NULL;
+  int block = 0;
+
+  if (dbx == NULL || msg_number >= dbx->message_count)
+    return 0;
+  _dbx_check_size(dbx);
+
+  block = dbx->info[msg_number].offset;
+  while (block != 0)
+    _dbx_message_blocks(dbx, &block, &total_size, ranges, DBX_MESSAGE_BLOCKS, 1, 0);
+
+  return total_size;
+}
+
+int dbx_message_copy(dbx_t *dbx, int msg_number, FILE *out)
+{
+  sys_range_t ranges[DBX_MESSAGE_BLOCKS];
+  unsigned int total_size = 0;
+  int block = 0;
+
+  if (dbx == NULL || msg_number >= dbx->message_count)
+    return 0;
+  _dbx_check_size(dbx);
+
+  /* corruption is reported by dbx_message_size */
+  block = dbx->info[msg_number].offset;
+  while (block != 0) {
+    int n = _dbx_message_blocks(dbx, &block, &total_size, ranges, DBX_MESSAGE_BLOCKS, 0, 1);
+    if (!sys_write_ranges(out, dbx->file, ranges, n))
+      return 0;
+  }
+
+  return 1;
+}
+
+char *dbx_message_into(dbx_t *dbx, int msg_number, char **pbuffer, size_t *pcapacity, unsigned int *psize)
+{
+  sys_range_t ranges[DBX_MESSAGE_BLOCKS];
+  unsigned int total_size = 0;
+  int block = 0;
+  int blocks = 0;
+  dbx_info_t *info = NULL;
 
   if (psize)
     *psize = 0;
 
   if (dbx == NULL || msg_number >= dbx->message_count)
     return NULL;
+  _dbx_check_size(dbx);
+
+  info = dbx->info + msg_number;
+  block = info->offset;
+
+  /* the message size is usually known, so the buffer is normally
+     allocated just once */
+  if ((info->valid & DBX_MASK_MSGSIZE) && block != 0 &&
+      info->message_size < dbx->file_size && info->message_size + 1 > *pcapacity) {
+    char *buffer = (char *)realloc(*pbuffer, info->message_size + 1);
+    if (buffer) {
+      *pbuffer = buffer;
+      *pcapacity = info->message_size + 1;
+    }
+  }
 
-  i = dbx->info[msg_number].offset;
-  total_size = 0;
+  while (block != 0) {
+    unsigned int size = total_size;
+    int n = _dbx_message_blocks(dbx, &block, &total_size, ranges, DBX_MESSAGE_BLOCKS, 1, 1);
+    int k = 0;
 
-  while (i != 0) {
-    fseek(dbx->file, i + 8, SEEK_SET);
-    block_size=0;
-    sys_fread_short(&block_size, dbx->file);
-    if (block_size <= 0 || block_size > 0x200) {
-      dbx_progress_message(dbx->progress_handle,
-                           DBX_STATUS_WARNING,
-                           "DBX file %s is corrupted (bad block size %04X at offset %08X)",
-                           dbx->filename,
-                           block_size,
-                           i + 8);
+    if (n == 0)
       break;
+
+    if (total_size + 1 > *pcapacity) {
+      size_t capacity = (*pcapacity)? 2 * (*pcapacity) : 0x1000;
+      char *buffer = NULL;
+      while (capacity < total_size + 1)
+        capacity *= 2;
+      buffer = (char *)realloc(*pbuffer, capacity);
+      if (buffer == NULL) {
+        perror("dbx_message (realloc)");
+        total_size = size;
+        break;
+      }
+      *pbuffer = buffer;
+      *pcapacity = capacity;
+    }
+
+    for (k = 0; k < n; k++) {
+      if (ranges[k].data)
+        memcpy(*pbuffer + size, ranges[k].data, ranges[k].size);
+      else if (sys_pread(dbx->file, *pbuffer + size, ranges[k].size, ranges[k].offset) != ranges[k].size)
+        memset(*pbuffer + size, 0, ranges[k].size);
+      size += ranges[k].size;
     }
-    fseek(dbx->file, 2, SEEK_CUR);
-    sys_fread_int(&i, dbx->file);
-    total_size += block_size;
-    buf = realloc(buf, total_size + 1);
-    sys_fread(buf + total_size - block_size, block_size, 1, dbx->file);
+    blocks += n;
   }
 
-  if (buf)
-    buf[total_size]='\0';
+  if (blocks == 0)
+    return NULL;
+
+  (*pbuffer)[total_size] = '\0';
 
   if (psize)
     *psize = total_size;
 
-  return buf;
+  return *pbuffer;
+}
+
+char *dbx_message(dbx_t *dbx, int msg_number, unsigned int *psize)
+{
+  char *buffer = NULL;
+  size_t capacity = 0;
+
+  if (dbx_message_into(dbx, msg_number, &buffer, &capacity, psize) == NULL) {
+    free(buffer);
+    return NULL;
+  }
+
+  return buffer;
 }
 
 char *dbx_recover_message(dbx_t *dbx, int chain_index, int msg_number, unsigned int *psize, time_t *ptimestamp, char **pfilename)
@@ -809,7 +1860,7 @@ char *dbx_recover_message(dbx_t *dbx, int chain_index, int msg_number, unsigned
   char suffix[sizeof(".0000000000000000.eml")];
   char *message = NULL;
   dbx_fragment_t *pfragment = NULL;
-  int ifragment = dbx->scan[chain_index].chains[msg_number] - dbx->scan[chain_index].fragments;
+  int ifragment = dbx->scan[chain_index]->chains[msg_number] - dbx->scan[chain_index]->fragments;
   unsigned int fsize = 0;
 
   time_t timestamp = 0;
@@ -817,23 +1868,23 @@ char *dbx_recover_message(dbx_t *dbx, int chain_index, int msg_number, unsigned
   char *to = NULL;
   char *from = NULL;
 
-  if (dbx->scan[chain_index].chain_fragment_count[msg_number] > 0)
-    message = (char *)calloc(1, dbx->scan[chain_index].chain_fragment_count[msg_number] * 0x200 + 1);
+  _dbx_check_size(dbx);
+  if (dbx->scan[chain_index]->chain_fragment_count[msg_number] > 0)
+    message = (char *)calloc(1, dbx->scan[chain_index]->chain_fragment_count[msg_number] * 0x200 + 1);
   if (message == NULL)
     return message;
   
   for ( ; ifragment >= 0; ifragment = pfragment->next) {
-    pfragment = dbx->scan[chain_index].fragments + ifragment;
+    pfragment = dbx->scan[chain_index]->fragments + ifragment;
     /* deleted fragments have size 0x210, which is wrong - it's 0x200 */
     fsize = pfragment->size <= 0x200? pfragment->size : 0x200;
-    fseek(dbx->file, pfragment->offset + 16 - dbx->scan[chain_index].offset, SEEK_SET);
-    sys_fread(message + size, fsize, 1, dbx->file);
+    _dbx_read(dbx, pfragment->offset + 16 - dbx->scan[chain_index]->offset, message + size, fsize);
     /* each deleted fragment starts with bad 4 bytes
        (it's set to the offset of the previous fragment)
        so we replace them with 4 dashes, which eases
        eml parsing and should at least make the text readable
     */
-    if (dbx->scan[chain_index].deleted)
+    if (dbx->scan[chain_index]->deleted)
       memset(message + size, '-', 4);
     if (dbx->options->debug) 
       printf("%08X: %08X %08X %04X\n",
@@ -849,7 +1900,7 @@ char *dbx_recover_message(dbx_t *dbx, int chain_index, int msg_number, unsigned
     /* lose trailing nul characters in deleted messages,
        since size of last fragment is unknown
     */
-    if (dbx->scan[chain_index].deleted) {
+    if (dbx->scan[chain_index]->deleted) {
       int zeros = 0;
       while (zeros <= size && message[size - zeros] == 0)
         zeros++;
@@ -860,7 +1911,7 @@ char *dbx_recover_message(dbx_t *dbx, int chain_index, int msg_number, unsigned
   }
 
   unsigned long long int message_offset =
-    dbx->scan[chain_index].chains[msg_number]->offset - dbx->scan[chain_index].offset;
+    dbx->scan[chain_index]->chains[msg_number]->offset - dbx->scan[chain_index]->offset;
   if (dbx->options->safe_mode) {
     sprintf(filename,
             "%016"
@@ -904,3 +1955,133 @@ char *dbx_recover_message(dbx_t *dbx, int chain_index, int msg_number, unsigned
 }
 
 
+
+/* pass the message body to func, block by block: blocks of a mapped
+   file are passed directly, others are read into a small buffer */
+int dbx_message_read(dbx_t *dbx, int msg_number, dbx_body_func_t func, void *arg)
+{
+  sys_range_t ranges[DBX_MESSAGE_BLOCKS];
+  char buffer[0x200];
+  unsigned int total_size = 0;
+  int block = 0;
+
+  if (dbx == NULL || msg_number < 0 || msg_number >= dbx->message_count)
+    return -1;
+  _dbx_check_size(dbx);
+
+  block = dbx->info[msg_number].offset;
+  while (block != 0) {
+    int n = _dbx_message_blocks(dbx, &block, &total_size, ranges, DBX_MESSAGE_BLOCKS, 0, 1);
+    int k = 0;
+
+    if (n == 0)
+      break;
+
+    for (k = 0; k < n; k++) {
+      const char *data = (const char *)ranges[k].data;
+      size_t size = ranges[k].size;
+      if (data == NULL) {
+        if (size > sizeof(buffer) || sys_pread(dbx->file, buffer, size, ranges[k].offset) != size)
+          return -1;
+        data = buffer;
+      }
+      if (func(arg, data, size) != 0)
+        return -1;
+    }
+  }
+
+  return 0;
+}
+
+typedef struct {
+  int offset;
+  int msg_number;
+} dbx_iter_order_t;
+
+struct dbx_iter_s {
+  dbx_t *dbx;
+  dbx_options_t options;
+  dbx_iter_order_t *order;
+  int next;
+  char *buffer;
+  size_t capacity;
+};
+
+static int _dbx_iter_cmp(const dbx_iter_order_t *ia, const dbx_iter_order_t *ib)
+{
+  return (ia->offset > ib->offset) - (ia->offset < ib->offset);
+}
+
+dbx_iter_t dbx_iter_open(char *filename, dbx_options_t *options)
+{
+  dbx_iter_t iter = (dbx_iter_t)calloc(1, sizeof(struct dbx_iter_s));
+  int i = 0;
+
+  if (iter == NULL)
+    return NULL;
+
+  if (options)
+    iter->options = *options;
+  else {
+    iter->options.verbosity = DBX_VERBOSITY_QUIET;
+    iter->options.jobs = 1;
+    iter->options.threads = 1;
+  }
+  /* messages are iterated, never recovered */
+  iter->options.recover = 0;
+
+  iter->dbx = dbx_open(filename, &iter->options);
+  if (iter->dbx == NULL || iter->dbx->type != DBX_TYPE_EMAIL) {
+    dbx_iter_close(iter);
+    return NULL;
+  }
+
+  /* iterate in file order, so the file is read sequentially */
+  iter->order = (dbx_iter_order_t *)malloc((iter->dbx->message_count + 1) * sizeof(dbx_iter_order_t));
+  if (iter->order == NULL) {
+    dbx_iter_close(iter);
+    return NULL;
+  }
+  for (i = 0; i < iter->dbx->message_count; i++) {
+    iter->order[i].offset = iter->dbx->info[i].offset;
+    iter->order[i].msg_number = i;
+  }
+  qsort(iter->order, iter->dbx->message_count, sizeof(dbx_iter_order_t), (dbx_cmpfunc_t) _dbx_iter_cmp);
+
+  return iter;
+}
+
+dbx_t *dbx_iter_dbx(dbx_iter_t iter)
+{
+  return iter? iter->dbx : NULL;
+}
+
+int dbx_iter_next(dbx_iter_t iter, dbx_view_t *view)
+{
+  int msg_number = 0;
+
+  if (iter == NULL || iter->next >= iter->dbx->message_count)
+    return 0;
+
+  msg_number = iter->order[iter->next++].msg_number;
+  view->msg_number = msg_number;
+  view->info = iter->dbx->info + msg_number;
+  view->body = dbx_message_into(iter->dbx, msg_number, &iter->buffer, &iter->capacity, &view->size);
+  if (view->body == NULL) {
+    view->body = "";
+    view->size = 0;
+  }
+
+  return 1;
+}
+
+void dbx_iter_close(dbx_iter_t iter)
+{
+  if (iter == NULL)
+    return;
+
+  dbx_close(iter->dbx);
+  free(iter->order);
+  free(iter->buffer);
+  free(iter);
+}
@@ -35,6 +35,7 @@ extern "C" {
 
 #include "dbxsys.h"
 #include "dbxprogress.h"
+#include "dbxstats.h"
   
 #define DBX_MAX_FILENAME 128 
 
@@ -75,36 +76,51 @@ extern "C" {
     int *chain_fragment_count;
   } dbx_chains_t;
 
+  /* info record field types */
+  typedef enum {
+    DBX_FIELD_MESSAGE_INDEX                   = 0x00,
+    DBX_FIELD_FLAGS                           = 0x01,
+    DBX_FIELD_SEND_CREATE_TIME                = 0x02,
+    DBX_FIELD_BODY_LINES                      = 0x03,
+    DBX_FIELD_MESSAGE_ADDRESS                 = 0x04,
+    DBX_FIELD_ORIGINAL_SUBJECT                = 0x05,
+    DBX_FIELD_SAVE_TIME                       = 0x06,
+    DBX_FIELD_MESSAGE_ID                      = 0x07,
+    DBX_FIELD_SUBJECT                         = 0x08,
+    DBX_FIELD_SENDER_ADDRESS_AND_NAME         = 0x09,
+    DBX_FIELD_MESSAGE_ID_REPLIED_TO           = 0x0A,
+    DBX_FIELD_SERVER_NEWSGROUP_MESSAGE_NUMBER = 0x0B,
+    DBX_FIELD_SERVER                          = 0x0C,
+    DBX_FIELD_SENDER_NAME                     = 0x0D,
+    DBX_FIELD_SENDER_ADDRESS                  = 0x0E,
+    DBX_FIELD_MESSAGE_PRIORITY                = 0x10,
+    DBX_FIELD_MESSAGE_SIZE                    = 0x11,
+    DBX_FIELD_RECEIVE_CREATE_TIME             = 0x12,
+    DBX_FIELD_RECEIVER_NAME                   = 0x13,
+    DBX_FIELD_RECEIVER_ADDRESS                = 0x14,
+    DBX_FIELD_ACCOUNT_NAME                    = 0x1A,
+    DBX_FIELD_ACCOUNT_REGISTRY_KEY            = 0x1B
+  } dbx_field_t;
+
+  /* only fields needed for naming and syncing messages are decoded
+     when the file is opened: use dbx_info_get_string/number for others */
   typedef struct dbx_info_s {
     int index;
     int offset;
     int extract;
     char *filename;
     dbx_mask_t valid;
-    unsigned int message_index;
-    unsigned int flags;
     filetime_t send_create_time;
-    unsigned int body_lines;
-    unsigned int message_address;
-    char *original_subject;
-    filetime_t save_time;
-    char *message_id;
-    char *subject;
-    char *sender_address_and_name;
-    char *message_id_replied_to;
-    char *server_newsgroup_message_number;
-    char *server;
-    char *sender_name;
-    char *sender_address;
-    unsigned int message_priority;
     unsigned int message_size;
     filetime_t receive_create_time;
-    char *receiver_name;
-    char *receiver_address;
-    char *account_name;
-    char *account_registry_key;
   } dbx_info_t;
 
+  typedef enum {
+    DBX_FORMAT_EML,
+    DBX_FORMAT_MBOX,
+    DBX_FORMAT_TAR
+  } dbx_format_t;
+
   typedef struct {
     int recover;
     int safe_mode;
@@ -112,11 +128,24 @@ extern "C" {
     int ignore0;
     dbx_verbosity_t verbosity;
     int debug;
+    int jobs;
+    int threads;
+    int direct_io;
+    dbx_format_t format;
+    dbx_stats_t *stats;
   } dbx_options_t;
   
+  typedef struct dbx_arena_s {
+    struct dbx_arena_s *next;
+    size_t size;
+    size_t used;
+  } dbx_arena_t;
+
   typedef struct dbx_s {
     char *filename;
     FILE *file;
+    unsigned char *map;
+    volatile unsigned int shrunk;
     dbx_options_t *options;
     dbx_progress_handle_t progress_handle;
     unsigned long long int file_size;
@@ -124,14 +153,40 @@ extern "C" {
     int message_count;
     int capacity;
     dbx_info_t *info;
-    dbx_chains_t *scan;
+    dbx_arena_t *arena;
+    dbx_chains_t **scan;
     int scan_count;
   } dbx_t;
 
+  /* a message, as returned by dbx_iter_next: the body is borrowed
+     from the iterator, and is valid until the next call */
+  typedef struct {
+    int msg_number;
+    const dbx_info_t *info;
+    const char *body;
+    unsigned int size;
+  } dbx_view_t;
+
+  typedef struct dbx_iter_s *dbx_iter_t;
+
+  /* called with consecutive parts of a message body: return non-zero to stop */
+  typedef int (*dbx_body_func_t)(void *arg, const char *data, size_t size);
+
   dbx_t *dbx_open(char *filename, dbx_options_t *options);
   void dbx_close(dbx_t *dbx);
+  int dbx_header_digest(char *filename, unsigned long long int *digest);
+  char *dbx_info_get_string(dbx_t *dbx, int msg_number, dbx_field_t field);
+  int dbx_info_get_number(dbx_t *dbx, int msg_number, dbx_field_t field, unsigned long long int *value);
   char *dbx_message(dbx_t *dbx, int msg_number, unsigned int *psize);
+  char *dbx_message_into(dbx_t *dbx, int msg_number, char **pbuffer, size_t *pcapacity, unsigned int *psize);
+  unsigned int dbx_message_size(dbx_t *dbx, int msg_number);
+  int dbx_message_copy(dbx_t *dbx, int msg_number, FILE *out);
   char *dbx_recover_message(dbx_t *dbx, int chain_index, int msg_number, unsigned int *psize, time_t *ptimestamp, char **pfilename);
+  int dbx_message_read(dbx_t *dbx, int msg_number, dbx_body_func_t func, void *arg);
+  dbx_iter_t dbx_iter_open(char *filename, dbx_options_t *options);
+  dbx_t *dbx_iter_dbx(dbx_iter_t iter);
+  int dbx_iter_next(dbx_iter_t iter, dbx_view_t *view);
+  void dbx_iter_close(dbx_iter_t iter);
   
 #ifdef __cplusplus
 };
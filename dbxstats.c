@@ -0,0 +1,190 @@
+/*
+    UnDBX - Tool to extract e-mail messages from Outlook Express DBX files.
+    Copyright (C) 2008-2015 Avi Rozen <avi.rozen@gmail.com>
+
+    DBX file format parsing code is based on DbxConv - a DBX to MBOX
+    Converter.  Copyright (C) 2008, 2009 Ulrich Krebs
+    <ukrebs@freenet.de>
+
+    RFC-2822 and RFC-2047 parsing code is adapted from GNU Mailutils -
+    a suite of utilities for electronic mail, Copyright (C) 2002,
+    2003, 2004, 2005, 2006, 2009, 2010 Free Software Foundation, Inc.
+
+    This file is part of UnDBX.
+
+    UnDBX is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include "dbxstats.h"
+
+#ifndef WIN32
+# define DBX_STATS_ULL "%llu"
+#else
+# define DBX_STATS_ULL "%I64u"
+#endif
+
+static const char *_dbx_phase_names[DBX_PHASE_COUNT] = {
+  "index", "info", "filenames", "scan", "glob", "sync", "read", "write", "timestamp"
+};
+
+static const char *_dbx_counter_names[DBX_COUNTER_COUNT] = {
+  "bytes_read", "reads", "seeks", "bytes_written",
+  "files_created", "files_moved", "files_deleted", "messages_skipped"
+};
+
+dbx_stats_t *dbx_stats_new(char *name)
+{
+  dbx_stats_t *stats = (dbx_stats_t *)calloc(1, sizeof(dbx_stats_t));
+
+  if (stats == NULL)
+    return NULL;
+
+  stats->name = name? strdup(name) : NULL;
+  stats->mutex = sys_mutex_new();
+  if (name && stats->name == NULL) {
+    dbx_stats_free(stats);
+    return NULL;
+  }
+
+  return stats;
+}
+
+void dbx_stats_free(dbx_stats_t *stats)
+{
+  if (stats) {
+    sys_mutex_delete(stats->mutex);
+    free(stats->name);
+    free(stats);
+  }
+}
+
+/* the start of an interval, or 0 if there are no stats to keep */
+double dbx_stats_clock(dbx_stats_t *stats)
+{
+  return stats? sys_clock() : 0;
+}
+
+/* add the time since start to phase: the returned end of the interval
+   is the start of the next one */
+double dbx_stats_lap(dbx_stats_t *stats, dbx_phase_t phase, double start)
+{
+  double now = 0;
+
+  if (stats == NULL)
+    return 0;
+
+  now = sys_clock();
+  sys_mutex_lock(stats->mutex);
+  stats->seconds[phase] += now - start;
+  sys_mutex_unlock(stats->mutex);
+
+  return now;
+}
+
+void dbx_stats_elapsed(dbx_stats_t *stats, double start)
+{
+  double now = 0;
+
+  if (stats == NULL)
+    return;
+
+  now = sys_clock();
+  sys_mutex_lock(stats->mutex);
+  stats->elapsed += now - start;
+  sys_mutex_unlock(stats->mutex);
+}
+
+void dbx_stats_count(dbx_stats_t *stats, dbx_counter_t counter, unsigned long long int n)
+{
+  if (stats == NULL)
+    return;
+
+  sys_mutex_lock(stats->mutex);
+  stats->counters[counter] += n;
+  sys_mutex_unlock(stats->mutex);
+}
+
+/* size bytes were read at offset, either from the file or from its mapping */
+void dbx_stats_read(dbx_stats_t *stats, unsigned long long int offset, unsigned long long int size)
+{
+  if (stats == NULL)
+    return;
+
+  sys_mutex_lock(stats->mutex);
+  stats->counters[DBX_COUNTER_BYTES_READ] += size;
+  stats->counters[DBX_COUNTER_READS]++;
+  if (offset < stats->read_start || offset > stats->read_end)
+    stats->counters[DBX_COUNTER_SEEKS]++;
+  stats->read_start = offset;
+  stats->read_end = offset + size;
+  sys_mutex_unlock(stats->mutex);
+}
+
+void dbx_stats_add(dbx_stats_t *total, dbx_stats_t *stats)
+{
+  int i = 0;
+
+  if (total == NULL || stats == NULL)
+    return;
+
+  for (i = 0; i < DBX_PHASE_COUNT; i++)
+    total->seconds[i] += stats->seconds[i];
+  for (i = 0; i < DBX_COUNTER_COUNT; i++)
+    total->counters[i] += stats->counters[i];
+}
+
+static void _dbx_stats_write(FILE *file, dbx_stats_t *stats, const char *indent)
+{
+  int i = 0;
+
+  fprintf(file, "{\n");
+  if (stats->name) {
+    fprintf(file, "%s  \"file\": ", indent);
+    sys_fputs_json(stats->name, file);
+    fprintf(file, ",\n");
+  }
+  fprintf(file, "%s  \"seconds\": %.6f,\n%s  \"phases\": {", indent, stats->elapsed, indent);
+  for (i = 0; i < DBX_PHASE_COUNT; i++)
+    fprintf(file, "%s\n%s    \"%s\": %.6f", i? ",":"", indent, _dbx_phase_names[i], stats->seconds[i]);
+  fprintf(file, "\n%s  },\n%s  \"counters\": {", indent, indent);
+  for (i = 0; i < DBX_COUNTER_COUNT; i++)
+    fprintf(file, "%s\n%s    \"%s\": " DBX_STATS_ULL, i? ",":"", indent, _dbx_counter_names[i], stats->counters[i]);
+  fprintf(file, "\n%s  }\n%s}", indent, indent);
+}
+
+/* write the stats of each file and the totals as a JSON object */
+int dbx_stats_write_json(FILE *file, dbx_stats_t **stats, int count, dbx_stats_t *total)
+{
+  int written = 0;
+  int i = 0;
+
+  fprintf(file, "{\n  \"files\": [");
+  for (i = 0; i < count; i++) {
+    if (stats[i] == NULL)
+      continue;
+    fprintf(file, "%s\n    ", written++? ",":"");
+    _dbx_stats_write(file, stats[i], "    ");
+  }
+  fprintf(file, "%s],\n  \"total\": ", written? "\n  ":"");
+  _dbx_stats_write(file, total, "  ");
+  fprintf(file, "\n}\n");
+
+  return ferror(file)? -1 : 0;
+}
@@ -0,0 +1,93 @@
+/*
+    UnDBX - Tool to extract e-mail messages from Outlook Express DBX files.
+    Copyright (C) 2008-2015 Avi Rozen <avi.rozen@gmail.com>
+
+    DBX file format parsing code is based on DbxConv - a DBX to MBOX
+    Converter.  Copyright (C) 2008, 2009 Ulrich Krebs
+    <ukrebs@freenet.de>
+
+    RFC-2822 and RFC-2047 parsing code is adapted from GNU Mailutils -
+    a suite of utilities for electronic mail, Copyright (C) 2002,
+    2003, 2004, 2005, 2006, 2009, 2010 Free Software Foundation, Inc.
+
+    This file is part of UnDBX.
+
+    UnDBX is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _DBX_STATS_H_
+#define _DBX_STATS_H_
+
+#include <stdio.h>
+#include "dbxsys.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  /* where the time goes: phases of different threads add up, so their
+     sum may exceed the elapsed time */
+  typedef enum {
+    DBX_PHASE_INDEX,       /* reading the index tree */
+    DBX_PHASE_INFO,        /* decoding message info records */
+    DBX_PHASE_FILENAMES,   /* generating unique file names */
+    DBX_PHASE_SCAN,        /* scanning for fragments in recovery mode */
+    DBX_PHASE_GLOB,        /* listing the output folder */
+    DBX_PHASE_SYNC,        /* matching messages with files on disk */
+    DBX_PHASE_READ,        /* reading messages */
+    DBX_PHASE_WRITE,       /* writing messages */
+    DBX_PHASE_TIMESTAMP,   /* setting file modification times */
+    DBX_PHASE_COUNT
+  } dbx_phase_t;
+
+  typedef enum {
+    DBX_COUNTER_BYTES_READ,
+    DBX_COUNTER_READS,
+    DBX_COUNTER_SEEKS,      /* reads that did not start within the previous one, or where it ended */
+    DBX_COUNTER_BYTES_WRITTEN,
+    DBX_COUNTER_FILES_CREATED,
+    DBX_COUNTER_FILES_MOVED,
+    DBX_COUNTER_FILES_DELETED,
+    DBX_COUNTER_MESSAGES_SKIPPED,
+    DBX_COUNTER_COUNT
+  } dbx_counter_t;
+
+  /* statistics of a single dbx file, or totals if name is NULL: all
+     functions do nothing if stats is NULL, so they can be called
+     unconditionally */
+  typedef struct {
+    char *name;
+    double elapsed;
+    double seconds[DBX_PHASE_COUNT];
+    unsigned long long int counters[DBX_COUNTER_COUNT];
+    unsigned long long int read_start;
+    unsigned long long int read_end;
+    sys_mutex_t mutex;
+  } dbx_stats_t;
+
+  dbx_stats_t *dbx_stats_new(char *name);
+  void dbx_stats_free(dbx_stats_t *stats);
+  double dbx_stats_clock(dbx_stats_t *stats);
+  double dbx_stats_lap(dbx_stats_t *stats, dbx_phase_t phase, double start);
+  void dbx_stats_elapsed(dbx_stats_t *stats, double start);
+  void dbx_stats_count(dbx_stats_t *stats, dbx_counter_t counter, unsigned long long int n);
+  void dbx_stats_read(dbx_stats_t *stats, unsigned long long int offset, unsigned long long int size);
+  void dbx_stats_add(dbx_stats_t *total, dbx_stats_t *stats);
+  int dbx_stats_write_json(FILE *file, dbx_stats_t **stats, int count, dbx_stats_t *total);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* _DBX_STATS_H_ */
@@ -39,29 +39,66 @@
 #include <sys/stat.h>
 #include <libgen.h>
 
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+# include <sys/time.h>
+#endif
+
 #include "dbxsys.h"
 
 #define JAN1ST1970 0x19DB1DED53E8000ULL
 #define NSPERSEC 1000000000ULL
+#define SYS_WRITE_RANGES 64
+
+#if (defined(__APPLE__) || defined(__unix__)) && \
+  defined(HAVE_OPENAT) && defined(HAVE_FDOPENDIR) && defined(HAVE_UTIMENSAT)
+# define SYS_DIRFD 1
+#endif
 
 #if defined(__APPLE__) || defined(__unix__)
 
 #include <glob.h>
+#include <fnmatch.h>
+#include <dirent.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <utime.h>
+#include <sys/time.h>
 
-static char **_sys_glob(char *pattern, int *num_files)
+static char **_sys_glob(char *parent, char *pattern, int *num_files)
 {
   int i = 0;
   char **files = NULL;
+  char *path = NULL;
+  char *p = NULL;
+  size_t l = 0;
   glob_t result;
 
-  glob(pattern, GLOB_MARK, NULL, &result);
+  /* escape glob special characters in parent directory name */
+  path = (char *)malloc(sizeof(char) * (2 * strlen(parent) + strlen("/") + strlen(pattern) + 1));
+  if (path == NULL)
+    return NULL;
+  for (p = path; *parent; parent++) {
+    if (strchr("\\*?[", *parent))
+      *p++ = '\\';
+    *p++ = *parent;
+  }
+  if (p != path)
+    *p++ = '/';
+  l = p - path;
+  strcpy(p, pattern);
+
+  memset(&result, 0, sizeof(result));
+  glob(path, GLOB_MARK, NULL, &result);
+  free(path);
 
   files = (char **)calloc(result.gl_pathc + 1, sizeof(char *));
   for (i = 0 ; i < result.gl_pathc; i++) {
-    files[i] = strdup(result.gl_pathv[i]);
+    /* strip parent directory from matching file names */
+    files[i] = strdup(result.gl_pathv[i] + l);
   }
   
   if (num_files)
@@ -77,22 +114,209 @@ static int _sys_mkdir(char *path)
   return (rc == 0 || errno == EEXIST)? 0:rc;
 }
 
-static int _sys_chdir(char *dir)
+static int _sys_set_time(char *filename, time_t timestamp)
 {
-  return chdir(dir);
+  struct utimbuf timbuf;
+  timbuf.actime = timestamp;
+  timbuf.modtime = timestamp;
+  return utime(filename, &timbuf);
 }
 
-static char *_sys_getcwd(void)
+static struct tm *_sys_gmtime(time_t timestamp, struct tm *tm)
 {
-  return getcwd(NULL, 0);
+  return gmtime_r(&timestamp, tm);
 }
 
-static int _sys_set_time(char *filename, time_t timestamp)
+static void *_sys_mmap(FILE *file, size_t size)
 {
-  struct utimbuf timbuf;
-  timbuf.actime = timestamp;
-  timbuf.modtime = timestamp;
-  return utime(filename, &timbuf);
+  void *addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+  return (addr == MAP_FAILED)? NULL:addr;
+}
+
+static void _sys_munmap(void *addr, size_t size)
+{
+  munmap(addr, size);
+}
+
+static size_t _sys_pread(FILE *file, void *ptr, size_t size, unsigned long long int offset)
+{
+  size_t n = 0;
+  while (n < size) {
+    ssize_t rc = pread(fileno(file), (char *)ptr + n, size - n, (off_t)(offset + n));
+    if (rc < 0 && errno == EINTR)
+      continue;
+    if (rc <= 0)
+      break;
+    n += rc;
+  }
+  return n;
+}
+
+static int _sys_write_all(int fd, struct iovec *iov, int n)
+{
+  while (n > 0) {
+    ssize_t rc = writev(fd, iov, n);
+    if (rc < 0 && errno == EINTR)
+      continue;
+    if (rc <= 0)
+      return 0;
+    /* skip what was written */
+    while (n > 0 && (size_t)rc >= iov->iov_len) {
+      rc -= iov->iov_len;
+      iov++;
+      n--;
+    }
+    if (n > 0) {
+      iov->iov_base = (char *)iov->iov_base + rc;
+      iov->iov_len -= rc;
+    }
+  }
+  return 1;
+}
+
+static int _sys_copy_range(FILE *out, FILE *in, unsigned long long int offset, size_t size)
+{
+  char buffer[0x1000];
+  struct iovec iov;
+
+#ifdef HAVE_COPY_FILE_RANGE
+  {
+    off_t off_in = (off_t)offset;
+    while (size > 0) {
+      ssize_t rc = copy_file_range(fileno(in), &off_in, fileno(out), NULL, size, 0);
+      if (rc < 0 && errno == EINTR)
+        continue;
+      if (rc <= 0)
+        break;
+      size -= rc;
+    }
+    if (size == 0)
+      return 1;
+    /* e.g. not supported by the file system: copy the rest via buffer */
+    offset = (unsigned long long int)off_in;
+  }
+#endif
+
+  while (size > 0) {
+    size_t n = (size < sizeof(buffer))? size : sizeof(buffer);
+    if (_sys_pread(in, buffer, n, offset) != n)
+      return 0;
+    iov.iov_base = buffer;
+    iov.iov_len = n;
+    if (!_sys_write_all(fileno(out), &iov, 1))
+      return 0;
+    offset += n;
+    size -= n;
+  }
+  return 1;
+}
+
+static int _sys_write_ranges(FILE *out, FILE *in, const sys_range_t *ranges, int count)
+{
+  struct iovec iov[SYS_WRITE_RANGES];
+  int i = 0;
+
+  /* everything is written to the underlying file descriptor */
+  if (fflush(out) != 0)
+    return 0;
+
+  while (i < count) {
+    int n = 0;
+
+    /* gather ranges that are in memory into a single write */
+    while (i < count && ranges[i].data && n < SYS_WRITE_RANGES) {
+      iov[n].iov_base = (void *)ranges[i].data;
+      iov[n].iov_len = ranges[i].size;
+      n++;
+      i++;
+    }
+    if (n > 0 && !_sys_write_all(fileno(out), iov, n))
+      return 0;
+
+    if (i < count && ranges[i].data == NULL) {
+      if (!_sys_copy_range(out, in, ranges[i].offset, ranges[i].size))
+        return 0;
+      i++;
+    }
+  }
+
+  return 1;
+}
+
+static FILE *_sys_fopen_direct(char *filename)
+{
+  int fd = -1;
+  FILE *file = NULL;
+
+#if defined(O_DIRECT)
+  fd = open(filename, O_RDONLY | O_DIRECT);
+#elif defined(F_NOCACHE)
+  fd = open(filename, O_RDONLY);
+  if (fd >= 0 && fcntl(fd, F_NOCACHE, 1) != 0) {
+    close(fd);
+    fd = -1;
+  }
+#endif
+  if (fd < 0)
+    return NULL;
+
+  file = fdopen(fd, "rb");
+  if (file == NULL)
+    close(fd);
+  return file;
+}
+
+static void _sys_advise_sequential(FILE *file, void *map, size_t size, int sequential)
+{
+#ifdef HAVE_POSIX_FADVISE
+  if (file)
+    posix_fadvise(fileno(file), 0, 0, sequential? POSIX_FADV_SEQUENTIAL : POSIX_FADV_NORMAL);
+#endif
+#ifdef HAVE_MADVISE
+  if (map)
+    madvise(map, size, sequential? MADV_SEQUENTIAL : MADV_NORMAL);
+#endif
+}
+
+static void *_sys_aligned_alloc(size_t alignment, size_t size)
+{
+#ifdef HAVE_POSIX_MEMALIGN
+  void *ptr = NULL;
+  return (posix_memalign(&ptr, alignment, size) == 0)? ptr:NULL;
+#else
+  /* keep the original pointer just below the aligned block */
+  char *base = (char *)malloc(size + alignment + sizeof(void *));
+  char *ptr = NULL;
+  if (base == NULL)
+    return NULL;
+  ptr = (char *)(((size_t)(base + sizeof(void *)) + alignment - 1) / alignment * alignment);
+  ((void **)ptr)[-1] = base;
+  return ptr;
+#endif
+}
+
+static void _sys_aligned_free(void *ptr)
+{
+#ifdef HAVE_POSIX_MEMALIGN
+  free(ptr);
+#else
+  if (ptr)
+    free(((void **)ptr)[-1]);
+#endif
+}
+
+static double _sys_clock(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+  {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+  }
 }
 
 #endif /*  defined(__APPLE__) || defined(__unix__) */
@@ -101,15 +325,21 @@ static int _sys_set_time(char *filename, time_t timestamp)
 
 #include <windows.h>
 #include <direct.h>
+#include <io.h>
 #include <sys/utime.h>
 
-static char **_sys_glob(char *pattern, int *num_files)
+static char **_sys_glob(char *parent, char *pattern, int *num_files)
 {
   char **files = NULL;
   int n = 0;
   WIN32_FIND_DATA f;
+  HANDLE h = INVALID_HANDLE_VALUE;
+  char *path = sys_path(parent, pattern);
 
-  HANDLE h = FindFirstFile(pattern, &f);
+  if (path == NULL)
+    return NULL;
+  h = FindFirstFile(path, &f);
+  free(path);
   
   if (h != INVALID_HANDLE_VALUE) {
 
@@ -137,64 +367,127 @@ static int _sys_mkdir(char *path)
   return (rc == 0 || errno == EEXIST)? 0:rc;
 }
 
-static int _sys_chdir(char *dir)
+static int _sys_set_time(char *filename, time_t timestamp)
 {
-  int rc;
-  /* _chdir doesn't if dir is just C: - must add \ */
-  int l = strlen(dir);
-  char *path = strdup(dir);
-  if (path == NULL)
-    return -1;
-  if (path[l-1] == ':') {
-    path = (char *)realloc(path, l + 2);
-    if (path == NULL)
-      return -1;
-    path[l] = '\\';
-    path[l+1] = '\0';
+  struct _utimbuf timbuf;
+  timbuf.actime = timestamp;
+  timbuf.modtime = timestamp;
+  return _utime(filename, &timbuf);
+}
+
+static struct tm *_sys_gmtime(time_t timestamp, struct tm *tm)
+{
+  return (gmtime_s(tm, &timestamp) == 0)? tm:NULL;
+}
+
+static void *_sys_mmap(FILE *file, size_t size)
+{
+  void *addr = NULL;
+  HANDLE h = CreateFileMapping((HANDLE) _get_osfhandle(_fileno(file)),
+                               NULL, PAGE_READONLY, 0, 0, NULL);
+  if (h != NULL) {
+    /* the view keeps a reference to the mapping object */
+    addr = MapViewOfFile(h, FILE_MAP_READ, 0, 0, size);
+    CloseHandle(h);
   }
-  rc = _chdir(path);
-  free(path);
-  return rc;
+  return addr;
 }
 
-static char *_sys_getcwd(void)
+static void _sys_munmap(void *addr, size_t size)
 {
-  return _getcwd(NULL, 0);
+  UnmapViewOfFile(addr);
 }
 
-static int _sys_set_time(char *filename, time_t timestamp)
+static size_t _sys_pread(FILE *file, void *ptr, size_t size, unsigned long long int offset)
 {
-  struct _utimbuf timbuf;
-  timbuf.actime = timestamp;
-  timbuf.modtime = timestamp;
-  return _utime(filename, &timbuf);
+  DWORD n = 0;
+  OVERLAPPED overlapped;
+  memset(&overlapped, 0, sizeof(overlapped));
+  overlapped.Offset = (DWORD)(offset & 0xFFFFFFFFULL);
+  overlapped.OffsetHigh = (DWORD)(offset >> 32);
+  if (!ReadFile((HANDLE) _get_osfhandle(_fileno(file)), ptr, (DWORD)size, &n, &overlapped))
+    return 0;
+  return n;
+}
+
+static int _sys_write_ranges(FILE *out, FILE *in, const sys_range_t *ranges, int count)
+{
+  char buffer[0x1000];
+  int i = 0;
+
+  for (i = 0; i < count; i++) {
+    unsigned long long int offset = ranges[i].offset;
+    size_t size = ranges[i].size;
+
+    if (ranges[i].data) {
+      if (fwrite(ranges[i].data, 1, size, out) != size)
+        return 0;
+      continue;
+    }
+
+    while (size > 0) {
+      size_t n = (size < sizeof(buffer))? size : sizeof(buffer);
+      if (_sys_pread(in, buffer, n, offset) != n ||
+          fwrite(buffer, 1, n, out) != n)
+        return 0;
+      offset += n;
+      size -= n;
+    }
+  }
+
+  return 1;
+}
+
+static FILE *_sys_fopen_direct(char *filename)
+{
+  /* unbuffered Win32 handles can't be wrapped by stdio */
+  return NULL;
+}
+
+static void _sys_advise_sequential(FILE *file, void *map, size_t size, int sequential)
+{
+}
+
+static void *_sys_aligned_alloc(size_t alignment, size_t size)
+{
+  return _aligned_malloc(size, alignment);
+}
+
+static void _sys_aligned_free(void *ptr)
+{
+  _aligned_free(ptr);
+}
+
+static double _sys_clock(void)
+{
+  LARGE_INTEGER frequency;
+  LARGE_INTEGER counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  return (double)counter.QuadPart / frequency.QuadPart;
 }
 
 #endif /* _WIN32 */
 
 
-char **sys_glob(char *parent, char *pattern, int *num_files)
+char *sys_path(char *parent, char *filename)
 {
-  int rc = 0;
-  char *cwd = NULL;
-  char **files = NULL;
-  *num_files = 0;
+  char *path = NULL;
 
-  cwd = sys_getcwd();
-  if (cwd == NULL)
-    return NULL;
-  
-  rc = sys_chdir(parent);
-  if (rc != 0) {
-    free(cwd);
-    return NULL;
-  }
-  
-  files = _sys_glob(pattern, num_files);
-  sys_chdir(cwd);
-  free(cwd);
+  if (parent == NULL || *parent == '\0')
+    return strdup(filename);
 
-  return files;
+  path = (char *)malloc(sizeof(char) * (strlen(parent) + strlen("/") + strlen(filename) + 1));
+  if (path)
+    sprintf(path, "%s/%s", parent, filename);
+
+  return path;
+}
+
+char **sys_glob(char *parent, char *pattern, int *num_files)
+{
+  *num_files = 0;
+  return _sys_glob(parent, pattern, num_files);
 }
 
 void sys_glob_free(char **files)
@@ -212,115 +505,132 @@ void sys_glob_free(char **files)
 int sys_mkdir(char *parent, char *dir)
 {
   int rc = 0;
-  char *cwd = NULL;
+  char *path = NULL;
 
-  rc = _sys_mkdir(parent);
-  if (rc != 0)
-    return rc;
+  /* a NULL parent is the current directory, which exists */
+  if (parent && *parent) {
+    rc = _sys_mkdir(parent);
+    if (rc != 0)
+      return rc;
+  }
 
-  cwd = sys_getcwd();
-  if (cwd == NULL)
-    return -1;
-  
-  rc = sys_chdir(parent);
-  if (rc != 0) {
-    free(cwd);
+  path = sys_path(parent, dir);
+  if (path == NULL)
     return -1;
-  }
   
-  rc = _sys_mkdir(dir);
-  sys_chdir(cwd);
-  free(cwd);
+  rc = _sys_mkdir(path);
+  free(path);
 
   return rc;
 }
 
-int sys_chdir(char *dir)
+unsigned long long int sys_filesize(char *parent, char *filename)
 {
-  if (dir == NULL)
+  int rc = 0;
+  unsigned long long int size = 0;
+  char *path = NULL;
+  struct stat buf;
+
+  path = sys_path(parent, filename);
+  if (path == NULL)
     return -1;
-  return _sys_chdir(dir);
+  
+  rc = stat(path, &buf);
+  size = (rc == 0)? buf.st_size:-1;
+  free(path);
+
+  return size;
 }
 
-char *sys_getcwd(void)
+/* modification time in nanoseconds, where the system keeps them */
+static unsigned long long int _sys_stat_mtime(struct stat *buf)
 {
-  return _sys_getcwd();
+  unsigned long long int mtime = (unsigned long long int)buf->st_mtime * NSPERSEC;
+#if defined(HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC)
+  mtime += buf->st_mtim.tv_nsec;
+#elif defined(HAVE_STRUCT_STAT_ST_MTIMESPEC_TV_NSEC)
+  mtime += buf->st_mtimespec.tv_nsec;
+#endif
+  return mtime;
 }
 
-unsigned long long int sys_filesize(char *parent, char *filename)
+/* status change time in nanoseconds, which unlike the modification
+   time can't be set back (on win32 this is the creation time) */
+static unsigned long long int _sys_stat_ctime(struct stat *buf)
+{
+  unsigned long long int ctime = (unsigned long long int)buf->st_ctime * NSPERSEC;
+#if defined(HAVE_STRUCT_STAT_ST_CTIM_TV_NSEC)
+  ctime += buf->st_ctim.tv_nsec;
+#elif defined(HAVE_STRUCT_STAT_ST_CTIMESPEC_TV_NSEC)
+  ctime += buf->st_ctimespec.tv_nsec;
+#endif
+  return ctime;
+}
+
+unsigned long long int sys_mtime(char *parent, char *filename)
 {
   int rc = 0;
-  unsigned long long int size = 0;
-  char *cwd = NULL;
+  char *path = NULL;
   struct stat buf;
 
-  cwd = sys_getcwd();
-  if (cwd == NULL)
-    return -1;
-  
-  rc = sys_chdir(parent);
-  if (rc != 0) {
-    free(cwd);
-    return -1;
-  }
-  
-  rc = stat(filename, &buf);
-  size = (rc == 0)? buf.st_size:-1;
+  path = filename? sys_path(parent, filename) : strdup(parent);
+  if (path == NULL)
+    return 0;
 
-  sys_chdir(cwd);
-  free(cwd);
+  rc = stat(path, &buf);
+  free(path);
 
-  return size;
+  return (rc == 0)? _sys_stat_mtime(&buf):0;
 }
 
-int sys_delete(char *parent, char *filename)
+unsigned long long int sys_ctime(char *parent, char *filename)
 {
   int rc = 0;
-  char *cwd = NULL;
+  char *path = NULL;
+  struct stat buf;
 
-  cwd = sys_getcwd();
-  if (cwd == NULL)
-    return -1;
-  
-  rc = sys_chdir(parent);
-  if (rc != 0) {
-    free(cwd);
-    return -1;
-  }
-  
-  rc = unlink(filename);
-  sys_chdir(cwd);
-  free(cwd);
+  path = filename? sys_path(parent, filename) : strdup(parent);
+  if (path == NULL)
+    return 0;
 
-  return rc;
+  rc = stat(path, &buf);
+  free(path);
+
+  return (rc == 0)? _sys_stat_ctime(&buf):0;
 }
 
-int sys_move(char *parent, char *filename, char *destination)
+int sys_delete(char *parent, char *filename)
 {
   int rc = 0;
-  char *cwd = NULL;
-  char *new_filename = NULL;
+  char *path = NULL;
 
-  cwd = sys_getcwd();
-  if (cwd == NULL)
+  path = sys_path(parent, filename);
+  if (path == NULL)
     return -1;
   
-  rc = sys_chdir(parent);
-  if (rc != 0) {
-    free(cwd);
-    return -1;
-  }
+  rc = unlink(path);
+  free(path);
+
+  return rc;
+}
 
-  new_filename = (char *)malloc(sizeof(char) *
-                                (strlen(destination) + strlen("/") + strlen(filename) + 1));
-  if (new_filename) {
-    sprintf(new_filename, "%s/%s", destination, filename);
-    rc = rename(filename, new_filename);
-    free(new_filename);
+int sys_move(char *parent, char *filename, char *destination)
+{
+  int rc = -1;
+  char *path = NULL;
+  char *new_path = NULL;
+
+  path = sys_path(parent, filename);
+  new_path = (char *)malloc(sizeof(char) *
+                            (strlen(parent) + strlen("/") +
+                             strlen(destination) + strlen("/") + strlen(filename) + 1));
+  if (path && new_path) {
+    sprintf(new_path, "%s/%s/%s", parent, destination, filename);
+    rc = rename(path, new_path);
   }
   
-  sys_chdir(cwd);
-  free(cwd);
+  free(new_path);
+  free(path);
 
   return rc;
 }
@@ -330,10 +640,271 @@ int sys_set_time(char *filename, time_t timestamp)
   return _sys_set_time(filename, timestamp);
 }
 
-int sys_set_filetime(char *filename, filetime_t filetime)
+/* thread safe gmtime, into the caller's tm */
+struct tm *sys_gmtime(time_t timestamp, struct tm *tm)
+{
+  return _sys_gmtime(timestamp, tm);
+}
+
+time_t sys_time(filetime_t filetime)
 {
   filetime_t t = (filetime - JAN1ST1970) / ((unsigned long long int) (NSPERSEC / 100));
-  return sys_set_time(filename, (time_t)t);
+  return (time_t)t;
+}
+
+int sys_set_filetime(char *filename, filetime_t filetime)
+{
+  return sys_set_time(filename, sys_time(filetime));
+}
+
+/* directory handles: files are accessed relative to an open directory
+   descriptor where the system supports it, or else via full paths */
+struct sys_dir_s {
+  char *path;
+#ifdef SYS_DIRFD
+  int fd;
+#endif
+};
+
+sys_dir_t sys_dir_open(sys_dir_t parent, char *name)
+{
+  sys_dir_t dir = (sys_dir_t)calloc(1, sizeof(struct sys_dir_s));
+
+  if (dir == NULL)
+    return NULL;
+
+  dir->path = parent? sys_path(parent->path, name) : strdup(name);
+  if (dir->path == NULL) {
+    free(dir);
+    return NULL;
+  }
+
+#ifdef SYS_DIRFD
+  dir->fd = openat(parent? parent->fd : AT_FDCWD, name, O_RDONLY | O_DIRECTORY);
+  if (dir->fd < 0) {
+    free(dir->path);
+    free(dir);
+    return NULL;
+  }
+#endif
+
+  return dir;
+}
+
+void sys_dir_close(sys_dir_t dir)
+{
+  if (dir) {
+#ifdef SYS_DIRFD
+    close(dir->fd);
+#endif
+    free(dir->path);
+    free(dir);
+  }
+}
+
+char *sys_dir_name(sys_dir_t dir)
+{
+  return dir->path;
+}
+
+#ifdef SYS_DIRFD
+
+int sys_dir_mkdir(sys_dir_t dir, char *name)
+{
+  int rc = mkdirat(dir->fd, name, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
+  return (rc == 0 || errno == EEXIST)? 0:rc;
+}
+
+char **sys_dir_glob(sys_dir_t dir, char *pattern, int *num_files)
+{
+  char **files = NULL;
+  int n = 0;
+  int fd = -1;
+  DIR *d = NULL;
+  struct dirent *entry = NULL;
+
+  *num_files = 0;
+
+  /* the directory stream takes over its descriptor, so use a copy */
+  fd = dup(dir->fd);
+  if (fd >= 0)
+    d = fdopendir(fd);
+  if (d == NULL) {
+    if (fd >= 0)
+      close(fd);
+    return (char **)calloc(1, sizeof(char *));
+  }
+  rewinddir(d);
+
+  while ((entry = readdir(d)) != NULL) {
+    int is_dir = 0;
+    char *file = NULL;
+
+    if (fnmatch(pattern, entry->d_name, FNM_PERIOD) != 0)
+      continue;
+
+    /* mark directories with a trailing slash, like GLOB_MARK */
+#ifdef DT_DIR
+    if (entry->d_type == DT_DIR)
+      is_dir = 1;
+    else if (entry->d_type == DT_UNKNOWN)
+#endif
+    {
+      struct stat buf;
+      is_dir = (fstatat(dir->fd, entry->d_name, &buf, 0) == 0 && S_ISDIR(buf.st_mode));
+    }
+
+    file = (char *)malloc(strlen(entry->d_name) + 2);
+    if (file == NULL)
+      break;
+    strcpy(file, entry->d_name);
+    if (is_dir)
+      strcat(file, "/");
+
+    files = (char **)realloc(files, sizeof(char *) * (n + 2));
+    files[n++] = file;
+    files[n] = NULL;
+  }
+
+  closedir(d);
+
+  if (files == NULL)
+    files = (char **)calloc(1, sizeof(char *));
+  *num_files = n;
+  return files;
+}
+
+FILE *sys_dir_fopen(sys_dir_t dir, char *filename, char *mode)
+{
+  int flags = (strchr(mode, '+'))? O_RDWR : ((mode[0] == 'r')? O_RDONLY : O_WRONLY);
+  int fd = -1;
+  FILE *file = NULL;
+
+  if (mode[0] == 'w')
+    flags |= O_CREAT | O_TRUNC;
+  else if (mode[0] == 'a')
+    flags |= O_CREAT | O_APPEND;
+
+  fd = openat(dir->fd, filename, flags, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+  if (fd < 0)
+    return NULL;
+
+  file = fdopen(fd, mode);
+  if (file == NULL)
+    close(fd);
+  return file;
+}
+
+unsigned long long int sys_dir_filesize(sys_dir_t dir, char *filename)
+{
+  struct stat buf;
+  return (fstatat(dir->fd, filename, &buf, 0) == 0)? buf.st_size:-1;
+}
+
+unsigned long long int sys_dir_mtime(sys_dir_t dir, char *filename)
+{
+  struct stat buf;
+  int rc = filename? fstatat(dir->fd, filename, &buf, 0) : fstat(dir->fd, &buf);
+  return (rc == 0)? _sys_stat_mtime(&buf):0;
+}
+
+unsigned long long int sys_dir_ctime(sys_dir_t dir, char *filename)
+{
+  struct stat buf;
+  int rc = filename? fstatat(dir->fd, filename, &buf, 0) : fstat(dir->fd, &buf);
+  return (rc == 0)? _sys_stat_ctime(&buf):0;
+}
+
+int sys_dir_delete(sys_dir_t dir, char *filename)
+{
+  return unlinkat(dir->fd, filename, 0);
+}
+
+int sys_dir_move(sys_dir_t dir, char *filename, char *destination)
+{
+  int rc = -1;
+  char *new_path = sys_path(destination, filename);
+
+  if (new_path)
+    rc = renameat(dir->fd, filename, dir->fd, new_path);
+  free(new_path);
+
+  return rc;
+}
+
+int sys_dir_set_time(sys_dir_t dir, char *filename, time_t timestamp)
+{
+  struct timespec times[2];
+  times[0].tv_sec = timestamp;
+  times[0].tv_nsec = 0;
+  times[1] = times[0];
+  return utimensat(dir->fd, filename, times, 0);
+}
+
+#else /* SYS_DIRFD */
+
+int sys_dir_mkdir(sys_dir_t dir, char *name)
+{
+  return sys_mkdir(dir->path, name);
+}
+
+char **sys_dir_glob(sys_dir_t dir, char *pattern, int *num_files)
+{
+  return sys_glob(dir->path, pattern, num_files);
+}
+
+FILE *sys_dir_fopen(sys_dir_t dir, char *filename, char *mode)
+{
+  FILE *file = NULL;
+  char *path = sys_path(dir->path, filename);
+
+  if (path)
+    file = fopen(path, mode);
+  free(path);
+  return file;
+}
+
+unsigned long long int sys_dir_filesize(sys_dir_t dir, char *filename)
+{
+  return sys_filesize(dir->path, filename);
+}
+
+unsigned long long int sys_dir_mtime(sys_dir_t dir, char *filename)
+{
+  return sys_mtime(dir->path, filename);
+}
+
+unsigned long long int sys_dir_ctime(sys_dir_t dir, char *filename)
+{
+  return sys_ctime(dir->path, filename);
+}
+
+int sys_dir_delete(sys_dir_t dir, char *filename)
+{
+  return sys_delete(dir->path, filename);
+}
+
+int sys_dir_move(sys_dir_t dir, char *filename, char *destination)
+{
+  return sys_move(dir->path, filename, destination);
+}
+
+int sys_dir_set_time(sys_dir_t dir, char *filename, time_t timestamp)
+{
+  int rc = -1;
+  char *path = sys_path(dir->path, filename);
+
+  if (path)
+    rc = sys_set_time(path, timestamp);
+  free(path);
+  return rc;
+}
+
+#endif /* SYS_DIRFD */
+
+int sys_dir_set_filetime(sys_dir_t dir, char *filename, filetime_t filetime)
+{
+  return sys_dir_set_time(dir, filename, sys_time(filetime));
 }
 
 char *sys_basename(char *path)
@@ -398,3 +969,445 @@ void sys_fread_short(short *value, FILE *file)
 #endif
 }
 
+
+size_t sys_pread(FILE *file, void *ptr, size_t size, unsigned long long int offset)
+{
+  return _sys_pread(file, ptr, size, offset);
+}
+
+int sys_write_ranges(FILE *out, FILE *in, const sys_range_t *ranges, int count)
+{
+  return _sys_write_ranges(out, in, ranges, count);
+}
+
+void *sys_mmap(FILE *file, unsigned long long int size)
+{
+  /* empty files can't be mapped, and files that don't fit in the
+     address space must be read via stdio */
+  if (file == NULL || size == 0 || size != (unsigned long long int)(size_t)size)
+    return NULL;
+  return _sys_mmap(file, (size_t)size);
+}
+
+void sys_munmap(void *addr, unsigned long long int size)
+{
+  if (addr)
+    _sys_munmap(addr, (size_t)size);
+}
+
+FILE *sys_fopen_direct(char *filename)
+{
+  return _sys_fopen_direct(filename);
+}
+
+FILE *sys_fdopen(int fd, char *mode)
+{
+#ifdef _WIN32
+  return _fdopen(fd, mode);
+#else
+  return fdopen(fd, mode);
+#endif
+}
+
+void sys_advise_sequential(FILE *file, void *map, unsigned long long int size, int sequential)
+{
+  _sys_advise_sequential(file, map, (size_t)size, sequential);
+}
+
+void *sys_aligned_alloc(size_t alignment, size_t size)
+{
+  return _sys_aligned_alloc(alignment, size);
+}
+
+void sys_aligned_free(void *ptr)
+{
+  _sys_aligned_free(ptr);
+}
+
+/* length of the valid UTF-8 sequence at p, or 0 */
+static int _sys_utf8_length(const unsigned char *p)
+{
+  int n = 0;
+  int i = 0;
+  unsigned char min = 0x80;
+  unsigned char max = 0xBF;
+
+  if (p[0] < 0x80)
+    return 1;
+  else if (p[0] >= 0xC2 && p[0] <= 0xDF)
+    n = 2;
+  else if (p[0] >= 0xE0 && p[0] <= 0xEF) {
+    n = 3;
+    /* no overlong forms, and no surrogates */
+    if (p[0] == 0xE0)
+      min = 0xA0;
+    else if (p[0] == 0xED)
+      max = 0x9F;
+  }
+  else if (p[0] >= 0xF0 && p[0] <= 0xF4) {
+    n = 4;
+    if (p[0] == 0xF0)
+      min = 0x90;
+    else if (p[0] == 0xF4)
+      max = 0x8F;
+  }
+  else
+    return 0;
+
+  if (p[1] < min || p[1] > max)
+    return 0;
+  for (i = 2; i < n; i++) {
+    if (p[i] < 0x80 || p[i] > 0xBF)
+      return 0;
+  }
+  return n;
+}
+
+/* write s as a quoted JSON string: strings read from DBX files are in
+   whatever code page they were written in, so bytes that aren't valid
+   UTF-8 are taken to be Latin-1, and escaped */
+void sys_fputs_json(const char *s, FILE *stream)
+{
+  const unsigned char *p = (const unsigned char *)s;
+
+  fputc('"', stream);
+  while (*p) {
+    int n = _sys_utf8_length(p);
+    if (*p == '"' || *p == '\\')
+      fprintf(stream, "\\%c", *p);
+    else if (*p < 0x20 || n == 0)
+      fprintf(stream, "\\u%04x", *p);
+    else {
+      fwrite(p, 1, n, stream);
+      p += n;
+      continue;
+    }
+    p++;
+  }
+  fputc('"', stream);
+}
+
+/* seconds since some fixed point in time, for measuring intervals */
+double sys_clock(void)
+{
+  return _sys_clock();
+}
+
+long long int sys_get_long_long(const void *ptr)
+{
+#ifndef WORDS_BIGENDIAN
+  long long int llw = 0;
+  memcpy(&llw, ptr, sizeof(long long int));
+  return llw;
+#else
+  /* the following code is endianness neutral */
+  const unsigned char *p = (const unsigned char *)ptr;
+  long long int llw = 0;
+  llw =  (long long int) p[0];
+  llw |= ((long long int) p[1] << 0x08);
+  llw |= ((long long int) p[2] << 0x10);
+  llw |= ((long long int) p[3] << 0x18);
+  llw |= ((long long int) p[4] << 0x20);
+  llw |= ((long long int) p[5] << 0x28);
+  llw |= ((long long int) p[6] << 0x30);
+  llw |= ((long long int) p[7] << 0x38);
+  return llw;
+#endif
+}
+
+int sys_get_int(const void *ptr)
+{
+#ifndef WORDS_BIGENDIAN
+  int dw = 0;
+  memcpy(&dw, ptr, sizeof(int));
+  return dw;
+#else
+  /* the following code is endianness neutral */
+  const unsigned char *p = (const unsigned char *)ptr;
+  int dw = 0;
+  dw =  (int) p[0];
+  dw |= ((int) p[1] << 0x08);
+  dw |= ((int) p[2] << 0x10);
+  dw |= ((int) p[3] << 0x18);
+  return dw;
+#endif
+}
+
+short sys_get_short(const void *ptr)
+{
+#ifndef WORDS_BIGENDIAN
+  short w = 0;
+  memcpy(&w, ptr, sizeof(short));
+  return w;
+#else
+  /* the following code is endianness neutral */
+  const unsigned char *p = (const unsigned char *)ptr;
+  short w = 0;
+  w =  (short) p[0];
+  w |= ((short) p[1] << 0x08);
+  return w;
+#endif
+}
+
+/* counters that threads update without taking a lock: adding 0
+   reads the current value */
+unsigned int sys_atomic_add(volatile unsigned int *value, unsigned int n)
+{
+#if defined(__GNUC__)
+  return __sync_add_and_fetch(value, n);
+#elif defined(_WIN32)
+  return (unsigned int)InterlockedExchangeAdd((volatile LONG *)value, (LONG)n) + n;
+#else
+  return *value += n;
+#endif
+}
+
+unsigned long long int sys_atomic_add_long_long(volatile unsigned long long int *value,
+                                                unsigned long long int n)
+{
+#if defined(__GNUC__)
+  return __sync_add_and_fetch(value, n);
+#elif defined(_WIN32)
+  return (unsigned long long int)InterlockedExchangeAdd64((volatile LONGLONG *)value, (LONGLONG)n) + n;
+#else
+  return *value += n;
+#endif
+}
+
+void sys_atomic_set(volatile unsigned int *value, unsigned int n)
+{
+#if defined(__GNUC__)
+  __atomic_store_n(value, n, __ATOMIC_SEQ_CST);
+#elif defined(_WIN32)
+  InterlockedExchange((volatile LONG *)value, (LONG)n);
+#else
+  *value = n;
+#endif
+}
+
+void sys_atomic_set_long_long(volatile unsigned long long int *value, unsigned long long int n)
+{
+#if defined(__GNUC__)
+  __atomic_store_n(value, n, __ATOMIC_SEQ_CST);
+#elif defined(_WIN32)
+  InterlockedExchange64((volatile LONGLONG *)value, (LONGLONG)n);
+#else
+  *value = n;
+#endif
+}
+
+#ifdef HAVE_PTHREAD_H
+
+struct sys_mutex_s {
+  pthread_mutex_t mutex;
+};
+
+struct sys_ticker_s {
+  double interval;
+  sys_tick_func_t tick;
+  void *arg;
+  int stop;
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+};
+
+typedef struct {
+  int count;
+  int next;
+  sys_work_func_t work;
+  void *arg;
+  pthread_mutex_t mutex;
+} _sys_parallel_t;
+
+/* a NULL mutex handle refers to this process-wide lock */
+static pthread_mutex_t _sys_global_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void *_sys_parallel_worker(void *arg)
+{
+  _sys_parallel_t *parallel = (_sys_parallel_t *)arg;
+
+  while (1) {
+    int index = 0;
+    pthread_mutex_lock(&parallel->mutex);
+    index = parallel->next++;
+    pthread_mutex_unlock(&parallel->mutex);
+    if (index >= parallel->count)
+      break;
+    parallel->work(parallel->arg, index);
+  }
+
+  return NULL;
+}
+
+sys_mutex_t sys_mutex_new(void)
+{
+  sys_mutex_t mutex = (sys_mutex_t)malloc(sizeof(struct sys_mutex_s));
+  if (mutex)
+    pthread_mutex_init(&mutex->mutex, NULL);
+  return mutex;
+}
+
+void sys_mutex_delete(sys_mutex_t mutex)
+{
+  if (mutex) {
+    pthread_mutex_destroy(&mutex->mutex);
+    free(mutex);
+  }
+}
+
+void sys_mutex_lock(sys_mutex_t mutex)
+{
+  pthread_mutex_lock(mutex? &mutex->mutex : &_sys_global_mutex);
+}
+
+void sys_mutex_unlock(sys_mutex_t mutex)
+{
+  pthread_mutex_unlock(mutex? &mutex->mutex : &_sys_global_mutex);
+}
+
+void sys_parallel(int jobs, int count, sys_work_func_t work, void *arg)
+{
+  int i = 0;
+  int n = 0;
+  pthread_t *threads = NULL;
+  _sys_parallel_t parallel;
+
+  if (jobs > count)
+    jobs = count;
+
+  if (jobs > 1)
+    threads = (pthread_t *)calloc(jobs, sizeof(pthread_t));
+
+  if (threads == NULL) {
+    for (i = 0; i < count; i++)
+      work(arg, i);
+    return;
+  }
+
+  parallel.count = count;
+  parallel.next = 0;
+  parallel.work = work;
+  parallel.arg = arg;
+  pthread_mutex_init(&parallel.mutex, NULL);
+
+  for (n = 0; n < jobs; n++) {
+    if (pthread_create(threads + n, NULL, _sys_parallel_worker, &parallel) != 0)
+      break;
+  }
+
+  /* if no thread could be started, do all the work here */
+  if (n == 0)
+    _sys_parallel_worker(&parallel);
+
+  for (i = 0; i < n; i++)
+    pthread_join(threads[i], NULL);
+
+  pthread_mutex_destroy(&parallel.mutex);
+  free(threads);
+}
+
+static void *_sys_ticker_thread(void *arg)
+{
+  sys_ticker_t ticker = (sys_ticker_t)arg;
+
+  pthread_mutex_lock(&ticker->mutex);
+  while (!ticker->stop) {
+    struct timespec deadline;
+    struct timeval tv;
+    long long int ns = 0;
+
+    gettimeofday(&tv, NULL);
+    ns = tv.tv_usec * 1000LL + (long long int)(ticker->interval * 1e9);
+    deadline.tv_sec = tv.tv_sec + (time_t)(ns / 1000000000LL);
+    deadline.tv_nsec = (long)(ns % 1000000000LL);
+    pthread_cond_timedwait(&ticker->cond, &ticker->mutex, &deadline);
+    if (ticker->stop)
+      break;
+
+    pthread_mutex_unlock(&ticker->mutex);
+    ticker->tick(ticker->arg);
+    pthread_mutex_lock(&ticker->mutex);
+  }
+  pthread_mutex_unlock(&ticker->mutex);
+
+  return NULL;
+}
+
+/* call tick(arg) every interval seconds from a thread of its own, until
+   the ticker is deleted */
+sys_ticker_t sys_ticker_new(double interval, sys_tick_func_t tick, void *arg)
+{
+  sys_ticker_t ticker = (sys_ticker_t)calloc(1, sizeof(struct sys_ticker_s));
+
+  if (ticker == NULL)
+    return NULL;
+
+  ticker->interval = interval;
+  ticker->tick = tick;
+  ticker->arg = arg;
+  pthread_mutex_init(&ticker->mutex, NULL);
+  pthread_cond_init(&ticker->cond, NULL);
+  if (pthread_create(&ticker->thread, NULL, _sys_ticker_thread, ticker) != 0) {
+    pthread_cond_destroy(&ticker->cond);
+    pthread_mutex_destroy(&ticker->mutex);
+    free(ticker);
+    return NULL;
+  }
+
+  return ticker;
+}
+
+/* once this returns, tick is no longer running and won't be called again */
+void sys_ticker_delete(sys_ticker_t ticker)
+{
+  if (ticker == NULL)
+    return;
+
+  pthread_mutex_lock(&ticker->mutex);
+  ticker->stop = 1;
+  pthread_cond_signal(&ticker->cond);
+  pthread_mutex_unlock(&ticker->mutex);
+  pthread_join(ticker->thread, NULL);
+  pthread_cond_destroy(&ticker->cond);
+  pthread_mutex_destroy(&ticker->mutex);
+  free(ticker);
+}
+
+#else /* HAVE_PTHREAD_H */
+
+sys_mutex_t sys_mutex_new(void)
+{
+  return NULL;
+}
+
+void sys_mutex_delete(sys_mutex_t mutex)
+{
+}
+
+void sys_mutex_lock(sys_mutex_t mutex)
+{
+}
+
+void sys_mutex_unlock(sys_mutex_t mutex)
+{
+}
+
+void sys_parallel(int jobs, int count, sys_work_func_t work, void *arg)
+{
+  int i = 0;
+  for (i = 0; i < count; i++)
+    work(arg, i);
+}
+
+/* without threads there's nobody to tick */
+sys_ticker_t sys_ticker_new(double interval, sys_tick_func_t tick, void *arg)
+{
+  return NULL;
+}
+
+void sys_ticker_delete(sys_ticker_t ticker)
+{
+}
+
+#endif /* HAVE_PTHREAD_H */
@@ -37,23 +37,78 @@ extern "C" {
 #endif
 
   typedef unsigned long long int filetime_t;
+  typedef struct sys_mutex_s *sys_mutex_t;
+  typedef struct sys_dir_s *sys_dir_t;
+  typedef void (*sys_work_func_t)(void *arg, int index);
+  typedef struct sys_ticker_s *sys_ticker_t;
+  typedef void (*sys_tick_func_t)(void *arg);
+
+  /* a range of bytes to write: taken from memory if data is set,
+     or else read from the input file at offset */
+  typedef struct {
+    const void *data;
+    unsigned long long int offset;
+    size_t size;
+  } sys_range_t;
   
+  char *sys_path(char *parent, char *filename);
   char **sys_glob(char *parent, char *pattern, int *num_files);
   void sys_glob_free(char **pglob);
   int sys_mkdir(char *parent, char *dir);
-  int sys_chdir(char *dir);
-  char *sys_getcwd(void);
   unsigned long long int sys_filesize(char *parent, char *filename);
+  unsigned long long int sys_mtime(char *parent, char *filename);
+  unsigned long long int sys_ctime(char *parent, char *filename);
   int sys_delete(char *parent, char *filename);
   int sys_move(char *parent, char *filename, char *destination);
   int sys_set_time(char *filename, time_t timestamp);
+  struct tm *sys_gmtime(time_t timestamp, struct tm *tm);
+  time_t sys_time(filetime_t filetime);
   int sys_set_filetime(char *filename, filetime_t filetime);
+  sys_dir_t sys_dir_open(sys_dir_t parent, char *name);
+  void sys_dir_close(sys_dir_t dir);
+  char *sys_dir_name(sys_dir_t dir);
+  int sys_dir_mkdir(sys_dir_t dir, char *name);
+  char **sys_dir_glob(sys_dir_t dir, char *pattern, int *num_files);
+  FILE *sys_dir_fopen(sys_dir_t dir, char *filename, char *mode);
+  unsigned long long int sys_dir_filesize(sys_dir_t dir, char *filename);
+  unsigned long long int sys_dir_mtime(sys_dir_t dir, char *filename);
+  unsigned long long int sys_dir_ctime(sys_dir_t dir, char *filename);
+  int sys_dir_delete(sys_dir_t dir, char *filename);
+  int sys_dir_move(sys_dir_t dir, char *filename, char *destination);
+  int sys_dir_set_time(sys_dir_t dir, char *filename, time_t timestamp);
+  int sys_dir_set_filetime(sys_dir_t dir, char *filename, filetime_t filetime);
   char *sys_basename(char *path);
   char *sys_dirname(char *path);
   size_t sys_fread(void * ptr, size_t size, size_t nitems, FILE * stream);
   void sys_fread_long_long(long long int *value, FILE *file);
   void sys_fread_int(int *value, FILE *file);
   void sys_fread_short(short *value, FILE *file);
+  size_t sys_pread(FILE *file, void *ptr, size_t size, unsigned long long int offset);
+  int sys_write_ranges(FILE *out, FILE *in, const sys_range_t *ranges, int count);
+  void *sys_mmap(FILE *file, unsigned long long int size);
+  void sys_munmap(void *addr, unsigned long long int size);
+  FILE *sys_fopen_direct(char *filename);
+  FILE *sys_fdopen(int fd, char *mode);
+  void sys_advise_sequential(FILE *file, void *map, unsigned long long int size, int sequential);
+  void *sys_aligned_alloc(size_t alignment, size_t size);
+  void sys_aligned_free(void *ptr);
+  double sys_clock(void);
+  void sys_fputs_json(const char *s, FILE *stream);
+  long long int sys_get_long_long(const void *ptr);
+  int sys_get_int(const void *ptr);
+  short sys_get_short(const void *ptr);
+  sys_mutex_t sys_mutex_new(void);
+  void sys_mutex_delete(sys_mutex_t mutex);
+  void sys_mutex_lock(sys_mutex_t mutex);
+  void sys_mutex_unlock(sys_mutex_t mutex);
+  void sys_parallel(int jobs, int count, sys_work_func_t work, void *arg);
+  unsigned int sys_atomic_add(volatile unsigned int *value, unsigned int n);
+  unsigned long long int sys_atomic_add_long_long(volatile unsigned long long int *value,
+                                                  unsigned long long int n);
+  void sys_atomic_set(volatile unsigned int *value, unsigned int n);
+  void sys_atomic_set_long_long(volatile unsigned long long int *value, unsigned long long int n);
+  sys_ticker_t sys_ticker_new(double interval, sys_tick_func_t tick, void *arg);
+  void sys_ticker_delete(sys_ticker_t ticker);
   
 #ifdef __cplusplus
 };
@@ -0,0 +1,261 @@
+/*
+    UnDBX - Tool to extract e-mail messages from Outlook Express DBX files.
+    Copyright (C) 2008-2015 Avi Rozen <avi.rozen@gmail.com>
+
+    DBX file format parsing code is based on DbxConv - a DBX to MBOX
+    Converter.  Copyright (C) 2008, 2009 Ulrich Krebs
+    <ukrebs@freenet.de>
+
+    RFC-2822 and RFC-2047 parsing code is adapted from GNU Mailutils -
+    a suite of utilities for electronic mail, Copyright (C) 2002,
+    2003, 2004, 2005, 2006, 2009, 2010 Free Software Foundation, Inc.
+
+    This file is part of UnDBX.
+
+    UnDBX is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dbxwrite.h"
+
+#define DBX_WRITE_BUFFER 0x100000
+#define DBX_TAR_BLOCK    512
+#define DBX_TAR_NAME     100
+
+struct dbx_writer_s {
+  FILE *file;
+  dbx_format_t format;
+  char *buffer;
+  size_t used;
+  int error;
+  sys_mutex_t mutex;
+};
+
+static const char _dbx_zeros[DBX_TAR_BLOCK] = { 0 };
+static const char *_dbx_days[7] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+static const char *_dbx_months[12] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                       "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+static void _dbx_writer_flush(dbx_writer_t writer)
+{
+  if (writer->used > 0 && fwrite(writer->buffer, 1, writer->used, writer->file) != writer->used)
+    writer->error = 1;
+  writer->used = 0;
+}
+
+/* output is collected into large sequential writes: data that does
+   not fit the buffer is written directly */
+static void _dbx_writer_write(dbx_writer_t writer, const char *data, size_t size)
+{
+  if (writer->buffer && size <= DBX_WRITE_BUFFER - writer->used) {
+    memcpy(writer->buffer + writer->used, data, size);
+    writer->used += size;
+    return;
+  }
+
+  _dbx_writer_flush(writer);
+  if (writer->buffer && size < DBX_WRITE_BUFFER) {
+    memcpy(writer->buffer, data, size);
+    writer->used = size;
+  }
+  else if (size > 0 && fwrite(data, 1, size, writer->file) != size) {
+    writer->error = 1;
+  }
+}
+
+/* the sender goes into the separator line as a single word */
+static const char *_dbx_mbox_sender(const char *sender)
+{
+  const char *p = NULL;
+
+  if (sender == NULL || *sender == '\0')
+    return "MAILER-DAEMON";
+
+  for (p = sender; *p; p++) {
+    if ((unsigned char)*p <= ' ' || (unsigned char)*p >= 0x7F)
+      return "MAILER-DAEMON";
+  }
+
+  return sender;
+}
+
+/* mboxrd: a "From " line, followed by the message with every line
+   that matches ^>*From quoted by one more '>', and an empty line */
+static void _dbx_mbox_add(dbx_writer_t writer, char *sender, time_t timestamp, char *message, unsigned int size)
+{
+  char *p = message;
+  char *end = message + size;
+  char *run = message;
+  char line[512];
+  int n = 0;
+  struct tm buf;
+  struct tm *tm = sys_gmtime(timestamp, &buf);
+
+  if (tm)
+    n = snprintf(line, sizeof(line), "From %.400s %s %s %2d %02d:%02d:%02d %d\n",
+                 _dbx_mbox_sender(sender),
+                 _dbx_days[tm->tm_wday], _dbx_months[tm->tm_mon], tm->tm_mday,
+                 tm->tm_hour, tm->tm_min, tm->tm_sec, tm->tm_year + 1900);
+  else
+    n = snprintf(line, sizeof(line), "From %.400s Thu Jan  1 00:00:00 1970\n", _dbx_mbox_sender(sender));
+  _dbx_writer_write(writer, line, n);
+
+  while (p < end) {
+    char *q = p;
+    char *eol = NULL;
+
+    while (q < end && *q == '>')
+      q++;
+    if (end - q >= 5 && memcmp(q, "From ", 5) == 0) {
+      _dbx_writer_write(writer, run, p - run);
+      _dbx_writer_write(writer, ">", 1);
+      run = p;
+    }
+
+    eol = (char *)memchr(q, '\n', end - q);
+    p = eol? eol + 1 : end;
+  }
+  _dbx_writer_write(writer, run, end - run);
+
+  if (size == 0 || message[size - 1] != '\n')
+    _dbx_writer_write(writer, "\n", 1);
+  _dbx_writer_write(writer, "\n", 1);
+}
+
+static void _dbx_tar_pad(dbx_writer_t writer, unsigned int size)
+{
+  unsigned int pad = (DBX_TAR_BLOCK - size % DBX_TAR_BLOCK) % DBX_TAR_BLOCK;
+  _dbx_writer_write(writer, _dbx_zeros, pad);
+}
+
+static void _dbx_tar_header(dbx_writer_t writer, const char *name, char type,
+                            unsigned int size, time_t timestamp)
+{
+  unsigned char header[DBX_TAR_BLOCK];
+  unsigned int checksum = 0;
+  int i = 0;
+
+  memset(header, 0, sizeof(header));
+  strncpy((char *)header, name, DBX_TAR_NAME);
+  sprintf((char *)header + 100, "%07o", 0644);
+  sprintf((char *)header + 108, "%07o", 0);
+  sprintf((char *)header + 116, "%07o", 0);
+  sprintf((char *)header + 124, "%011o", size);
+  sprintf((char *)header + 136, "%011lo", (unsigned long)(timestamp > 0? timestamp : 0));
+  memset(header + 148, ' ', 8);
+  header[156] = type;
+  /* GNU magic, which allows for the 'L' long name entries */
+  memcpy(header + 257, "ustar  ", 8);
+
+  for (i = 0; i < DBX_TAR_BLOCK; i++)
+    checksum += header[i];
+  sprintf((char *)header + 148, "%06o", checksum);
+
+  _dbx_writer_write(writer, (char *)header, DBX_TAR_BLOCK);
+}
+
+/* a tar entry, preceded by a GNU long name entry if the name does not
+   fit the header */
+static void _dbx_tar_add(dbx_writer_t writer, char *name, time_t timestamp, char *message, unsigned int size)
+{
+  unsigned int length = strlen(name);
+
+  if (length > DBX_TAR_NAME) {
+    _dbx_tar_header(writer, "././@LongLink", 'L', length + 1, 0);
+    _dbx_writer_write(writer, name, length + 1);
+    _dbx_tar_pad(writer, length + 1);
+  }
+
+  _dbx_tar_header(writer, name, '0', size, timestamp);
+  _dbx_writer_write(writer, message, size);
+  _dbx_tar_pad(writer, size);
+}
+
+dbx_writer_t dbx_writer_new(FILE *file, dbx_format_t format)
+{
+  dbx_writer_t writer = (dbx_writer_t)calloc(1, sizeof(struct dbx_writer_s));
+
+  if (writer == NULL) {
+    perror("dbx_writer_new (calloc)");
+    return NULL;
+  }
+
+  writer->file = file;
+  writer->format = format;
+  writer->buffer = (char *)malloc(DBX_WRITE_BUFFER);
+  writer->mutex = sys_mutex_new();
+
+  return writer;
+}
+
+int dbx_writer_add(dbx_writer_t writer,
+                   char *name,
+                   char *sender,
+                   time_t timestamp,
+                   char *message,
+                   unsigned int size)
+{
+  int rc = 0;
+
+  /* several dbx files may be written to the same stream at once, so
+     each entry is written as a whole */
+  sys_mutex_lock(writer->mutex);
+
+  switch (writer->format) {
+  case DBX_FORMAT_MBOX:
+    _dbx_mbox_add(writer, sender, timestamp, message, size);
+    break;
+  case DBX_FORMAT_TAR:
+    _dbx_tar_add(writer, name, timestamp, message, size);
+    break;
+  default:
+    writer->error = 1;
+    break;
+  }
+
+  rc = writer->error? -1 : 0;
+  sys_mutex_unlock(writer->mutex);
+
+  return rc;
+}
+
+/* flush all output: the stream itself is left open */
+int dbx_writer_close(dbx_writer_t writer)
+{
+  int rc = 0;
+
+  if (writer == NULL)
+    return -1;
+
+  /* end of archive */
+  if (writer->format == DBX_FORMAT_TAR) {
+    _dbx_writer_write(writer, _dbx_zeros, DBX_TAR_BLOCK);
+    _dbx_writer_write(writer, _dbx_zeros, DBX_TAR_BLOCK);
+  }
+
+  _dbx_writer_flush(writer);
+  if (fflush(writer->file) != 0 || ferror(writer->file) || writer->error)
+    rc = -1;
+
+  sys_mutex_delete(writer->mutex);
+  free(writer->buffer);
+  free(writer);
+  return rc;
+}
@@ -0,0 +1,23 @@
+#!/bin/sh
+# mbox and tar output into an output folder that doesn't exist yet
+
+set -e
+
+dir=test-formats.tmp
+rm -rf $dir
+mkdir $dir
+
+./dbxgen -n 20 -z 500:5000 $dir/Test.dbx >/dev/null
+
+for format in mbox tar; do
+  ./undbx -v 0 --format $format $dir/Test.dbx $dir/$format >/dev/null
+  if test ! -s $dir/$format/Test.$format; then
+    echo "FAIL: $format output was not written to a new folder"
+    exit 1
+  fi
+done
+
+test `grep -c '^From ' $dir/mbox/Test.mbox` -eq 20
+test `tar -tf $dir/tar/Test.tar | grep -c '\.eml$'` -eq 20
+
+rm -rf $dir
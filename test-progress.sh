@@ -0,0 +1,22 @@
+#!/bin/sh
+# progress events are valid JSON, even for 8-bit message subjects
+
+set -e
+
+dir=test-progress.tmp
+rm -rf $dir
+mkdir $dir
+
+./dbxgen -n 20 -z 500:5000 --latin1 $dir/Test.dbx >/dev/null
+./undbx -v 4 --progress jsonl $dir/Test.dbx $dir/out >$dir/events
+
+test `grep -c '"event": "saved"' $dir/events` -eq 20
+test `grep -c 'caf\\\\u00e9' $dir/events` -eq 20
+
+# no raw 8-bit bytes left
+if test `LC_ALL=C tr -d '\000-\177' <$dir/events | wc -c` -ne 0; then
+  echo "FAIL: raw 8-bit bytes in progress events"
+  exit 1
+fi
+
+rm -rf $dir
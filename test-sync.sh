@@ -0,0 +1,56 @@
+#!/bin/sh
+# a DBX file is skipped only while neither it nor its output folder changed
+
+set -e
+
+dir=test-sync.tmp
+rm -rf $dir
+mkdir $dir
+
+./dbxgen -n 20 -z 500:5000 $dir/Test.dbx >/dev/null
+./undbx $dir/Test.dbx $dir/out >/dev/null
+
+# unchanged: not even opened
+./undbx $dir/Test.dbx $dir/out >$dir/log
+if ! grep -q 'DBX file not modified' $dir/log; then
+  echo "FAIL: unchanged DBX file was not skipped"
+  exit 1
+fi
+
+# same size and modification time, different header: synchronized
+cp -p $dir/Test.dbx $dir/Test.orig
+printf '\001' | dd of=$dir/Test.dbx bs=1 seek=48 conv=notrunc 2>/dev/null
+touch -r $dir/Test.orig $dir/Test.dbx
+./undbx $dir/Test.dbx $dir/out >$dir/log
+if grep -q 'DBX file not modified' $dir/log; then
+  echo "FAIL: DBX file with a different header was skipped"
+  exit 1
+fi
+grep -q '0 messages saved, 20 skipped' $dir/log
+
+# a deleted message file is extracted again
+eml=`ls $dir/out/Test | head -n 1`
+rm -f "$dir/out/Test/$eml"
+./undbx $dir/Test.dbx $dir/out >$dir/log
+if test ! -s "$dir/out/Test/$eml"; then
+  echo "FAIL: deleted message file was not extracted again"
+  exit 1
+fi
+grep -q '1 messages saved' $dir/log
+
+# a damaged message file is trusted while the folder times are
+# unchanged, until the manifest is deleted
+cp "$dir/out/Test/$eml" $dir/eml.orig
+: >"$dir/out/Test/$eml"
+printf '\002' | dd of=$dir/Test.dbx bs=1 seek=48 conv=notrunc 2>/dev/null
+./undbx $dir/Test.dbx $dir/out >$dir/log
+grep -q '0 messages saved, 20 skipped' $dir/log
+test ! -s "$dir/out/Test/$eml"
+rm -f $dir/out/Test/.undbx
+./undbx $dir/Test.dbx $dir/out >$dir/log
+if ! cmp -s $dir/eml.orig "$dir/out/Test/$eml"; then
+  echo "FAIL: damaged message file was not repaired without a manifest"
+  exit 1
+fi
+
+rm -rf $dir
@@ -37,45 +37,46 @@
 #include <errno.h>
 #include <getopt.h>
 #include "dbxread.h"
+#include "dbxmanifest.h"
+#include "dbxwrite.h"
 
 typedef enum { DBX_SAVE_NOOP, DBX_SAVE_OK, DBX_SAVE_ERROR } dbx_save_status_t;
 typedef enum { DBX_EXTRACT_IGNORE, DBX_EXTRACT_FORCE, DBX_EXTRACT_MAYBE } dbx_extract_decision_t;
 
+#define DBX_EXTRACT_CHUNK 64
+
+typedef struct {
+  int offset;
+  int imessage;
+} undbx_order_t;
+
+typedef struct {
+  dbx_t *dbx;
+  sys_dir_t eml_dir;
+  undbx_order_t *order;
+  dbx_manifest_entry_t **known;
+  unsigned long long int *sizes;
+  int chunk_size;
+  volatile unsigned int saved;
+  volatile unsigned int errors;
+} undbx_extract_t;
+
 static int _str_cmp(const char **ia, const char **ib)
 {
   return strcmp(*ia, *ib);
 }
 
-static int _dbx_offset_cmp(const dbx_info_t *ia, const dbx_info_t *ib)
+static int _dbx_offset_cmp(const undbx_order_t *ia, const undbx_order_t *ib)
 {
-  return (ia->offset - ib->offset);
+  return (ia->offset > ib->offset) - (ia->offset < ib->offset);
 }
 
-static dbx_save_status_t _save_message(char *dir, char *filename, char *message, unsigned int size)
+static dbx_save_status_t _save_message(sys_dir_t dir, char *filename, char *message, unsigned int size)
 {
   FILE *eml = NULL;
-  char *cwd = NULL;
   size_t b = 0;
-  int rc = 0;
-
-  cwd = sys_getcwd();
-  if (cwd == NULL) {
-    perror("_save_message (sys_getcwd)");
-    return DBX_SAVE_ERROR;
-  }
-  
-  rc = sys_chdir(dir);
-  if (rc != 0) {
-    perror("_save_message (sys_chdir)");
-    return DBX_SAVE_ERROR;
-  }
-
-  eml = fopen(filename, "w+b");
 
-  sys_chdir(cwd);
-  free(cwd);
-  cwd = NULL;
-  
+  eml = sys_dir_fopen(dir, filename, "w+b");
   if (eml == NULL) {
     perror("_save_message (fopen)");    
     return DBX_SAVE_ERROR;
@@ -84,6 +85,7 @@ static dbx_save_status_t _save_message(char *dir, char *filename, char *message,
   b = fwrite(message, 1, size, eml);
   if (b != size) {
     perror("_save_message (fwrite)");
+    fclose(eml);
     return DBX_SAVE_ERROR;
   }
 
@@ -92,95 +94,145 @@ static dbx_save_status_t _save_message(char *dir, char *filename, char *message,
 }
 
 
-static void _set_message_time(char *dir, char *filename, time_t timestamp)
+static void _set_message_filetime(dbx_info_t *info, sys_dir_t dir)
 {
-  char *cwd = NULL;
-  int rc = 0;
-
-  cwd = sys_getcwd();
-  if (cwd == NULL) {
-    perror("_set_message_time (sys_getcwd)");
-    return;
-  }
-  
-  rc = sys_chdir(dir);
-  if (rc != 0) {
-    perror("_set_message_time (sys_chdir)");
-    return;
-  }
-
-  sys_set_time(filename, timestamp);
-
-  sys_chdir(cwd);
-  free(cwd);
-  cwd = NULL;
+  filetime_t filetime = info->send_create_time? info->send_create_time : info->receive_create_time;
+  sys_dir_set_filetime(dir, info->filename, filetime);
 }
 
-static void _set_message_filetime(dbx_info_t *info, char *dir)
+static dbx_save_status_t _copy_message(dbx_t *dbx, int imessage, sys_dir_t dir, char *filename)
 {
-  char *cwd = NULL;
-  int rc = 0;
-  filetime_t filetime = 0;
+  FILE *eml = NULL;
 
-  cwd = sys_getcwd();
-  if (cwd == NULL) {
-    perror("_set_message_filetime (sys_getcwd)");
-    return;
-  }
-  
-  rc = sys_chdir(dir);
-  if (rc != 0) {
-    perror("_set_message_filetime (sys_chdir)");
-    return;
+  eml = sys_dir_fopen(dir, filename, "w+b");
+  if (eml == NULL) {
+    perror("_copy_message (fopen)");
+    return DBX_SAVE_ERROR;
   }
 
-  filetime = info->send_create_time? info->send_create_time : info->receive_create_time;
-
-  sys_set_filetime(info->filename, filetime);
+  /* message blocks are written directly from the dbx file */
+  if (!dbx_message_copy(dbx, imessage, eml)) {
+    perror("_copy_message (write)");
+    fclose(eml);
+    return DBX_SAVE_ERROR;
+  }
 
-  sys_chdir(cwd);
-  free(cwd);
-  cwd = NULL;
+  fclose(eml);
+  return DBX_SAVE_OK;
 }
 
-static dbx_save_status_t _maybe_save_message(dbx_t *dbx, int imessage, char *dir, int force)
+/* known is the manifest entry of the file on disk, if there is one:
+   the file is then neither stat-ed, nor compared if the message was
+   not moved in the dbx file. psize is set to the file size on disk */
+static dbx_save_status_t _maybe_save_message(dbx_t *dbx, int imessage, sys_dir_t dir, int force,
+                                             dbx_manifest_entry_t *known, unsigned long long int *psize)
 {
   dbx_save_status_t status = DBX_SAVE_NOOP;
   dbx_info_t *info = dbx->info + imessage;
+  dbx_stats_t *stats = dbx->options->stats;
+  double lap = dbx_stats_clock(stats);
   unsigned long long int size = 0;
   unsigned int message_size = 0;
-  char *message = NULL;
 
-  if (!force) 
-    size = sys_filesize(dir, info->filename);
+  if (!force) {
+    if (known && known->offset == info->offset) {
+      *psize = known->size;
+      return DBX_SAVE_NOOP;
+    }
+    size = known? known->size : sys_dir_filesize(dir, info->filename);
+    lap = dbx_stats_lap(stats, DBX_PHASE_SYNC, lap);
+  }
+  *psize = size;
   
   if (force || (info->valid & DBX_MASK_MSGSIZE) == 0 || size != info->message_size) {
-    message = dbx_message(dbx, imessage, &message_size);
+    message_size = dbx_message_size(dbx, imessage);
+    lap = dbx_stats_lap(stats, DBX_PHASE_READ, lap);
     if (force || (size != message_size)) {
-      status = _save_message(dir, info->filename, message, message_size);
-      switch (status) {
-      case DBX_SAVE_ERROR:
-        dbx_progress_update(dbx->progress_handle, DBX_STATUS_ERROR, imessage, "%s", info->filename);
-        break;
-      case DBX_SAVE_OK:
+      /* message data is read while it is written */
+      status = _copy_message(dbx, imessage, dir, info->filename);
+      lap = dbx_stats_lap(stats, DBX_PHASE_WRITE, lap);
+      if (status == DBX_SAVE_OK) {
+        dbx_stats_count(stats, DBX_COUNTER_FILES_CREATED, 1);
+        dbx_stats_count(stats, DBX_COUNTER_BYTES_WRITTEN, message_size);
         _set_message_filetime(info, dir);
-        dbx_progress_update(dbx->progress_handle, DBX_STATUS_OK, imessage, "%s", info->filename);
-        break;
-      default:
-        break;
+        dbx_stats_lap(stats, DBX_PHASE_TIMESTAMP, lap);
+        *psize = message_size;
       }
     }
-    free(message);
   }
 
   return status;
 }
 
 
-static void _recover(dbx_t *dbx, char *out_dir, char *eml_dir, int *saved, int *errors)
+static void _extract_chunk(void *arg, int chunk)
+{
+  undbx_extract_t *extract = (undbx_extract_t *)arg;
+  dbx_t *dbx = extract->dbx;
+  int i = chunk * extract->chunk_size;
+  int last = i + extract->chunk_size;
+
+  if (last > dbx->message_count)
+    last = dbx->message_count;
+
+  for(; i < last; i++) {
+    dbx_save_status_t status = DBX_SAVE_NOOP;
+    int imessage = extract->order[i].imessage;
+    char *filename = dbx->info[imessage].filename;
+    dbx_manifest_entry_t *known = extract->known[imessage];
+    unsigned long long int *psize = extract->sizes + imessage;
+
+    switch (dbx->info[imessage].extract) {
+    case DBX_EXTRACT_IGNORE:
+      break;
+    case DBX_EXTRACT_FORCE:
+      status = _maybe_save_message(dbx, imessage, extract->eml_dir, 1, known, psize);
+      break;
+    case DBX_EXTRACT_MAYBE:
+      status = _maybe_save_message(dbx, imessage, extract->eml_dir, 0, known, psize);
+      break;
+    }
+
+    /* progress is reported by number of messages processed so far,
+       regardless of the order in which threads complete them */
+    dbx_progress_add(dbx->progress_handle, 1, (status == DBX_SAVE_OK)? *psize : 0);
+    switch (status) {
+    case DBX_SAVE_ERROR:
+      sys_atomic_add(&extract->errors, 1);
+      dbx_progress_update(dbx->progress_handle, DBX_STATUS_ERROR, -1, "%s", filename);
+      break;
+    case DBX_SAVE_OK:
+      sys_atomic_add(&extract->saved, 1);
+      dbx_progress_update_size(dbx->progress_handle, DBX_STATUS_OK, -1, *psize, "%s", filename);
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+/* stream entries are named as the files would be, relative to the output folder */
+static dbx_save_status_t _add_message(dbx_writer_t writer, char *entry_dir, char *filename, char *sender,
+                                      time_t timestamp, char *message, unsigned int size)
+{
+  dbx_save_status_t status = DBX_SAVE_ERROR;
+  char *name = sys_path(entry_dir, filename);
+
+  if (name && dbx_writer_add(writer, name, sender, timestamp, message, size) == 0)
+    status = DBX_SAVE_OK;
+  free(name);
+
+  return status;
+}
+
+/* recovered messages are saved as files in eml_dir, or else added to
+   writer as entries in the entry_dir folder */
+static void _recover(dbx_t *dbx, sys_dir_t eml_dir, dbx_writer_t writer, char *entry_dir, char *out_name,
+                     int *saved, int *errors)
 {
   int i = 0;
   const char *scan_type[2] = { "messages", "deleted message fragments" };
+  dbx_stats_t *stats = dbx->options->stats;
   
   for(i = 0; i < dbx->scan_count; i++) {
     int s = 0;
@@ -192,62 +244,79 @@ static void _recover(dbx_t *dbx, char *out_dir, char *eml_dir, int *saved, int *
     unsigned int size = 0;
     time_t timestamp = 0;
     
-    if (dbx->scan[i].count > 0) {
-      char *dest_dir = strdup(eml_dir);
-      if (dbx->scan[i].deleted) {
-        dest_dir = (char *)realloc(dest_dir, sizeof(char) * (strlen(dest_dir) + strlen("/deleted") + 1));
-        strcat(dest_dir, "/deleted");
-      }
+    if (dbx->scan[i]->count > 0) {
+      sys_dir_t dest_dir = eml_dir;
+      char *dest_name = (dbx->scan[i]->deleted && writer == NULL)? sys_path(out_name, "deleted") : NULL;
+      char *dest_entry_dir = (dbx->scan[i]->deleted && writer)? sys_path(entry_dir, "deleted") : NULL;
 
       dbx_progress_push(dbx->progress_handle,
                         DBX_VERBOSITY_INFO,
-                        dbx->scan[i].count,
+                        dbx->scan[i]->count,
                         "Recovering %d %s with offset %"
 #ifndef WIN32
                         "ll"
 #else
                         "I64"
 #endif
-                        "d from %s to %s/%s",
-                        dbx->scan[i].count,
-                        scan_type[dbx->scan[i].deleted],
-                        dbx->scan[i].offset,
+                        "d from %s to %s",
+                        dbx->scan[i]->count,
+                        scan_type[dbx->scan[i]->deleted],
+                        dbx->scan[i]->offset,
                         dbx->filename,
-                        out_dir,
-                        dest_dir);
-      if (dbx->scan[i].deleted) {
-        int rc = sys_mkdir(eml_dir, "deleted");
-        if (rc != 0) {
-          perror("_recover (sys_mkdir)");
+                        dest_name? dest_name : out_name);
+      free(dest_name);
+      if (dbx->scan[i]->deleted && writer == NULL) {
+        int rc = sys_dir_mkdir(eml_dir, "deleted");
+        if (rc == 0)
+          dest_dir = sys_dir_open(eml_dir, "deleted");
+        if (rc != 0 || dest_dir == NULL) {
+          perror("_recover (sys_dir_mkdir)");
           break;
         }
       }
-      for (imessage = 0; imessage < dbx->scan[i].count; imessage++) {
+      for (imessage = 0; imessage < dbx->scan[i]->count; imessage++) {
+        double lap = dbx_stats_clock(stats);
         message = dbx_recover_message(dbx, i, imessage, &size, &timestamp, &filename);
+        lap = dbx_stats_lap(stats, DBX_PHASE_READ, lap);
         if (message) {
-          status = _save_message(dest_dir, filename, message, size);
+          if (writer)
+            status = _add_message(writer, dest_entry_dir? dest_entry_dir : entry_dir,
+                                  filename, NULL, timestamp, message, size);
+          else
+            status = _save_message(dest_dir, filename, message, size);
+          lap = dbx_stats_lap(stats, DBX_PHASE_WRITE, lap);
+          dbx_progress_add(dbx->progress_handle, 1, (status == DBX_SAVE_OK)? size : 0);
           switch (status) {
           case DBX_SAVE_ERROR:
             e++;
-            dbx_progress_update(dbx->progress_handle, DBX_STATUS_ERROR, imessage, "%s", filename);
+            dbx_progress_update(dbx->progress_handle, DBX_STATUS_ERROR, -1, "%s", filename);
             break;
           case DBX_SAVE_OK:
             s++;
-            _set_message_time(dest_dir, filename, timestamp);
-            dbx_progress_update(dbx->progress_handle, DBX_STATUS_OK, imessage, "%s", filename);
+            dbx_stats_count(stats, DBX_COUNTER_BYTES_WRITTEN, size);
+            if (writer == NULL) {
+              dbx_stats_count(stats, DBX_COUNTER_FILES_CREATED, 1);
+              sys_dir_set_time(dest_dir, filename, timestamp);
+              dbx_stats_lap(stats, DBX_PHASE_TIMESTAMP, lap);
+            }
+            dbx_progress_update_size(dbx->progress_handle, DBX_STATUS_OK, -1, size, "%s", filename);
             break;
           default:
             break;
           }
         }
+        else
+          dbx_progress_add(dbx->progress_handle, 1, 0);
         free(filename);
         free(message);
       }
-      free(dest_dir);
+      if (dest_dir != eml_dir)
+        sys_dir_close(dest_dir);
+      free(dest_entry_dir);
       dbx_progress_pop(dbx->progress_handle,
                        "%d %s recovered, %d errors",
                        s,
-                       scan_type[dbx->scan[i].deleted],
+                       scan_type[dbx->scan[i]->deleted],
                        e);
     }
     *saved += s;
@@ -255,7 +324,86 @@ static void _recover(dbx_t *dbx, char *out_dir, char *eml_dir, int *saved, int *
   }
 }
 
-static void _extract(dbx_t *dbx, char *out_dir, char *eml_dir, int *saved, int *deleted, int *errors)
+/* the state of the dbx file and the options it was extracted with */
+static void _stamp_manifest(dbx_manifest_t *stamp, char *dbx_dir, char *dbx_file, dbx_options_t *options)
+{
+  char *dbx_path = sys_path(dbx_dir, dbx_file);
+
+  stamp->dbx_size = sys_filesize(dbx_dir, dbx_file);
+  stamp->dbx_mtime = sys_mtime(dbx_dir, dbx_file);
+  stamp->dbx_digest = 0;
+  if (dbx_path == NULL || dbx_header_digest(dbx_path, &stamp->dbx_digest) != 0)
+    stamp->dbx_mtime = 0;
+  stamp->options = (options->safe_mode? 1:0) | (options->ignore0? 2:0);
+  free(dbx_path);
+}
+
+/* the dbx file need not be opened at all, if neither it nor the
+   output directory changed since the manifest was written */
+static int _unchanged(dbx_manifest_t *stamp, char *eml_path, int *message_count)
+{
+  int unchanged = 0;
+  sys_dir_t eml_dir = NULL;
+  dbx_manifest_t *manifest = NULL;
+
+  if (stamp->dbx_mtime == 0)
+    return 0;
+
+  eml_dir = sys_dir_open(NULL, eml_path);
+  if (eml_dir)
+    manifest = dbx_manifest_load(eml_dir);
+
+  if (manifest) {
+    unchanged = (manifest->dbx_size == stamp->dbx_size &&
+                 manifest->dbx_mtime == stamp->dbx_mtime &&
+                 manifest->dbx_digest == stamp->dbx_digest &&
+                 manifest->options == stamp->options);
+    *message_count = manifest->entry_count;
+  }
+
+  dbx_manifest_free(manifest);
+  sys_dir_close(eml_dir);
+
+  return unchanged;
+}
+
+/* record the files left on disk, so the next run can skip listing them */
+static void _save_manifest(dbx_t *dbx, sys_dir_t eml_dir, dbx_manifest_t *stamp,
+                           unsigned long long int *sizes)
+{
+  dbx_manifest_t *manifest = NULL;
+  int imessage = 0;
+  int n = 0;
+
+  manifest = dbx_manifest_new(dbx->message_count);
+  if (manifest == NULL)
+    return;
+
+  manifest->dbx_size = stamp->dbx_size;
+  manifest->dbx_mtime = stamp->dbx_mtime;
+  manifest->dbx_digest = stamp->dbx_digest;
+  manifest->options = stamp->options;
+  for (imessage = 0; imessage < dbx->message_count; imessage++) {
+    dbx_info_t *info = dbx->info + imessage;
+    dbx_manifest_entry_t *entry = manifest->entries + n;
+    if (info->extract == DBX_EXTRACT_IGNORE)
+      continue;
+    entry->index = info->index;
+    entry->offset = info->offset;
+    entry->size = sizes[imessage];
+    entry->filename = strdup(info->filename);
+    manifest->entry_count = ++n;
+    if (entry->filename == NULL)
+      break;
+  }
+
+  if (imessage == dbx->message_count)
+    dbx_manifest_save(manifest, eml_dir);
+  dbx_manifest_free(manifest);
+}
+
+static void _extract(dbx_t *dbx, sys_dir_t eml_dir, dbx_manifest_t *stamp,
+                     int *saved, int *deleted, int *errors)
 {
   int no_more_messages = 0;
   int no_more_files = 0;
@@ -263,28 +411,51 @@ static void _extract(dbx_t *dbx, char *out_dir, char *eml_dir, int *saved, int *
   int num_eml_files = 0;
   int imessage = 0;
   int ifile = 0;
+  int failed = 0;
+  dbx_manifest_t *manifest = NULL;
+  undbx_order_t *order = NULL;
+  dbx_manifest_entry_t **known = NULL;
+  unsigned long long int *sizes = NULL;
+  dbx_stats_t *stats = dbx->options->stats;
+  double lap = dbx_stats_clock(stats);
   
   dbx_progress_push(dbx->progress_handle,
                     DBX_VERBOSITY_INFO,
                     dbx->message_count,
-                    "Extracting %d messages from %s to %s/%s",
+                    "Extracting %d messages from %s to %s",
                     dbx->message_count,
                     dbx->filename,
-                    out_dir,
-                    eml_dir);
+                    sys_dir_name(eml_dir));
 
-  eml_files = sys_glob(eml_dir, "*.eml", &num_eml_files);
+  /* the manifest written by the previous run replaces listing the
+     directory, as long as nothing was added to it or removed since */
+  manifest = dbx_manifest_load(eml_dir);
+  if (manifest) {
+    num_eml_files = manifest->entry_count;
+  }
+  else {
+    eml_files = sys_dir_glob(eml_dir, "*.eml", &num_eml_files);
+    qsort(eml_files, num_eml_files, sizeof(char *), (dbx_cmpfunc_t) _str_cmp);
+  }
+  lap = dbx_stats_lap(stats, DBX_PHASE_GLOB, lap);
+  dbx_manifest_invalidate(eml_dir);
 
   no_more_messages = (imessage == dbx->message_count);
   no_more_files = (ifile == num_eml_files);
-  
-  qsort(eml_files, num_eml_files, sizeof(char *), (dbx_cmpfunc_t) _str_cmp);
+
+  order = (undbx_order_t *)calloc(dbx->message_count + 1, sizeof(undbx_order_t));
+  known = (dbx_manifest_entry_t **)calloc(dbx->message_count + 1, sizeof(dbx_manifest_entry_t *));
+  sizes = (unsigned long long int *)calloc(dbx->message_count + 1, sizeof(unsigned long long int));
+  if (order == NULL || known == NULL || sizes == NULL) {
+    perror("_extract (calloc)");
+    goto EXTRACT_DONE;
+  }
       
   if (!dbx->options->delete_deleted) {
-    int rc = sys_mkdir(eml_dir, "deleted");
+    int rc = sys_dir_mkdir(eml_dir, "deleted");
     if (rc != 0) {
-      perror("_extract (sys_mkdir)");
-      return;
+      perror("_extract (sys_dir_mkdir)");
+      goto EXTRACT_DONE;
     }
   }
 
@@ -292,13 +463,17 @@ static void _extract(dbx_t *dbx, char *out_dir, char *eml_dir, int *saved, int *
       
     int cond;
     int ignore;
+    char *eml_file = NULL;
+
+    if (!no_more_files)
+      eml_file = manifest? manifest->entries[ifile].filename : eml_files[ifile];
 
     ignore = (dbx->options->ignore0 &&
               !no_more_messages &&
               dbx->info[imessage].offset == 0);
     
     if (!no_more_messages && !no_more_files) {
-      cond = strcmp(dbx->info[imessage].filename, eml_files[ifile]);
+      cond = strcmp(dbx->info[imessage].filename, eml_file);
       if (ignore && cond == 0) {
         cond = 1;
         imessage++;
@@ -321,22 +496,32 @@ static void _extract(dbx_t *dbx, char *out_dir, char *eml_dir, int *saved, int *
     else if (cond == 0) {
       /* message found on disk: extract from dbx if modified */
       dbx->info[imessage].extract = DBX_EXTRACT_MAYBE; 
+      if (manifest)
+        known[imessage] = manifest->entries + ifile;
       imessage++;
       ifile++;
     }
     else {
       /* file on disk not found in dbx: move it to 'deleted' sub-folder or delete from disk */
       if (!dbx->options->delete_deleted) {
-        int rc = sys_move(eml_dir, eml_files[ifile], "deleted");
-        if (rc != 0) 
-          perror("_extract (sys_move)");
-        dbx_progress_update(dbx->progress_handle, DBX_STATUS_MOVED, -1, "%s", eml_files[ifile]);
+        int rc = sys_dir_move(eml_dir, eml_file, "deleted");
+        if (rc != 0) {
+          perror("_extract (sys_dir_move)");
+          failed = 1;
+        }
+        else
+          dbx_stats_count(stats, DBX_COUNTER_FILES_MOVED, 1);
+        dbx_progress_update(dbx->progress_handle, DBX_STATUS_MOVED, -1, "%s", eml_file);
       }
       else {
-        int rc = sys_delete(eml_dir, eml_files[ifile]);
-        if (rc != 0) 
-          perror("_extract (sys_delete)");
-        dbx_progress_update(dbx->progress_handle, DBX_STATUS_DELETED, -1, "%s", eml_files[ifile]);        
+        int rc = sys_dir_delete(eml_dir, eml_file);
+        if (rc != 0) {
+          perror("_extract (sys_dir_delete)");
+          failed = 1;
+        }
+        else
+          dbx_stats_count(stats, DBX_COUNTER_FILES_DELETED, 1);
+        dbx_progress_update(dbx->progress_handle, DBX_STATUS_DELETED, -1, "%s", eml_file);        
       }
       ifile++;
       (*deleted)++;
@@ -347,28 +532,42 @@ static void _extract(dbx_t *dbx, char *out_dir, char *eml_dir, int *saved, int *
   }
 
   /* sort entries by offset: should make extraction faster in most cases */
-  qsort(dbx->info, dbx->message_count, sizeof(dbx_info_t), (dbx_cmpfunc_t) _dbx_offset_cmp);
+  for (imessage = 0; imessage < dbx->message_count; imessage++) {
+    order[imessage].offset = dbx->info[imessage].offset;
+    order[imessage].imessage = imessage;
+  }
+  qsort(order, dbx->message_count, sizeof(undbx_order_t), (dbx_cmpfunc_t) _dbx_offset_cmp);
+  dbx_stats_lap(stats, DBX_PHASE_SYNC, lap);
   
-  for(imessage = 0; imessage < dbx->message_count; imessage++) {
-    dbx_save_status_t status = DBX_SAVE_NOOP;
+  /* messages are extracted in chunks of consecutive offsets, so each
+     thread still reads the file mostly sequentially */
+  if (dbx->message_count > 0) {
+    undbx_extract_t extract;
+    extract.dbx = dbx;
+    extract.eml_dir = eml_dir;
+    extract.order = order;
+    extract.known = known;
+    extract.sizes = sizes;
+    extract.chunk_size = (dbx->options->threads > 1)? DBX_EXTRACT_CHUNK : dbx->message_count;
+    extract.saved = 0;
+    extract.errors = 0;
+    sys_parallel(dbx->options->threads,
+                 (dbx->message_count + extract.chunk_size - 1) / extract.chunk_size,
+                 _extract_chunk,
+                 &extract);
+    *saved += extract.saved;
+    *errors += extract.errors;
+  }
 
-    switch (dbx->info[imessage].extract) {
-    case DBX_EXTRACT_IGNORE:
-      break;
-    case DBX_EXTRACT_FORCE:
-      status = _maybe_save_message(dbx, imessage, eml_dir, 1);
-      break;
-    case DBX_EXTRACT_MAYBE:
-      status = _maybe_save_message(dbx, imessage, eml_dir, 0);
-      break;
-    }
-        
-    if (status == DBX_SAVE_OK)
-      (*saved)++;
-    if (status == DBX_SAVE_ERROR)
-      (*errors)++;
+  if (*errors == 0 && !failed) {
+    lap = dbx_stats_clock(stats);
+    _save_manifest(dbx, eml_dir, stamp, sizes);
+    dbx_stats_lap(stats, DBX_PHASE_SYNC, lap);
   }
 
+  dbx_stats_count(stats, DBX_COUNTER_MESSAGES_SKIPPED, dbx->message_count - *saved - *errors);
+
+ EXTRACT_DONE:
   dbx_progress_pop(dbx->progress_handle,
                    "%d messages saved, %d skipped, %d errors, %d files %s",
                    *saved,
@@ -377,36 +576,199 @@ static void _extract(dbx_t *dbx, char *out_dir, char *eml_dir, int *saved, int *
                    *deleted,
                    !dbx->options->delete_deleted? "moved":"deleted");
   
+  free(sizes);
+  free(known);
+  free(order);
+  dbx_manifest_free(manifest);
   sys_glob_free(eml_files);
 }
 
-static int _undbx(char *dbx_dir, char *out_dir, char *dbx_file, dbx_options_t *options)
+/* all messages are written to a single stream, in file order */
+static void _export(dbx_t *dbx, dbx_writer_t writer, char *entry_dir, char *out_name, int *saved, int *errors)
+{
+  undbx_order_t *order = NULL;
+  char *buffer = NULL;
+  size_t capacity = 0;
+  dbx_stats_t *stats = dbx->options->stats;
+  int i = 0;
+  
+  dbx_progress_push(dbx->progress_handle,
+                    DBX_VERBOSITY_INFO,
+                    dbx->message_count,
+                    "Extracting %d messages from %s to %s",
+                    dbx->message_count,
+                    dbx->filename,
+                    out_name);
+
+  order = (undbx_order_t *)calloc(dbx->message_count + 1, sizeof(undbx_order_t));
+  if (order == NULL) {
+    perror("_export (calloc)");
+    (*errors)++;
+  }
+  else {
+    for (i = 0; i < dbx->message_count; i++) {
+      order[i].offset = dbx->info[i].offset;
+      order[i].imessage = i;
+    }
+    qsort(order, dbx->message_count, sizeof(undbx_order_t), (dbx_cmpfunc_t) _dbx_offset_cmp);
+  }
+
+  for (i = 0; order && i < dbx->message_count; i++) {
+    int imessage = order[i].imessage;
+    dbx_info_t *info = dbx->info + imessage;
+    filetime_t filetime = info->send_create_time? info->send_create_time : info->receive_create_time;
+    char *sender = NULL;
+    char *message = NULL;
+    unsigned int size = 0;
+    dbx_save_status_t status = DBX_SAVE_NOOP;
+    double lap = 0;
+
+    if (dbx->options->ignore0 && info->offset == 0)
+      continue;
+
+    lap = dbx_stats_clock(stats);
+    message = dbx_message_into(dbx, imessage, &buffer, &capacity, &size);
+    sender = dbx_info_get_string(dbx, imessage, DBX_FIELD_SENDER_ADDRESS);
+    lap = dbx_stats_lap(stats, DBX_PHASE_READ, lap);
+    status = _add_message(writer, entry_dir, info->filename, sender,
+                          sys_time(filetime), message? message : "", size);
+    dbx_stats_lap(stats, DBX_PHASE_WRITE, lap);
+    if (status == DBX_SAVE_OK) {
+      dbx_stats_count(stats, DBX_COUNTER_BYTES_WRITTEN, size);
+      (*saved)++;
+      dbx_progress_add(dbx->progress_handle, 1, size);
+      dbx_progress_update_size(dbx->progress_handle, DBX_STATUS_OK, -1, size, "%s", info->filename);
+    }
+    else {
+      (*errors)++;
+      dbx_progress_add(dbx->progress_handle, 1, 0);
+      dbx_progress_update(dbx->progress_handle, DBX_STATUS_ERROR, -1, "%s", info->filename);
+    }
+    free(sender);
+  }
+
+  dbx_stats_count(stats, DBX_COUNTER_MESSAGES_SKIPPED, dbx->message_count - *saved - *errors);
+  dbx_progress_pop(dbx->progress_handle,
+                   "%d messages saved, %d skipped, %d errors",
+                   *saved,
+                   dbx->message_count - *saved - *errors,
+                   *errors);
+
+  free(buffer);
+  free(order);
+}
+
+/* write all messages of the dbx file into out_dir/<name>.<format>, or
+   else into a stream shared with other dbx files */
+static int _write_stream(dbx_t *dbx, char *out_dir, char *eml_name, dbx_writer_t stream,
+                         int *saved, int *errors)
+{
+  FILE *file = NULL;
+  dbx_writer_t writer = stream;
+  char *out_file = NULL;
+  char *out_path = NULL;
+  const char *ext = (dbx->options->format == DBX_FORMAT_TAR)? ".tar" : ".mbox";
+  int rc = -1;
+
+  if (writer == NULL) {
+    out_file = (char *)malloc(strlen(eml_name) + strlen(ext) + 1);
+    if (out_file) {
+      sprintf(out_file, "%s%s", eml_name, ext);
+      out_path = sys_path(out_dir, out_file);
+    }
+    if (sys_mkdir(NULL, out_dir) != 0) {
+      dbx_progress_message(dbx->progress_handle, DBX_STATUS_ERROR, "can't create directory %s", out_dir);
+      goto WRITE_DONE;
+    }
+    if (out_path)
+      file = fopen(out_path, "wb");
+    if (file)
+      writer = dbx_writer_new(file, dbx->options->format);
+    if (writer == NULL) {
+      dbx_progress_message(dbx->progress_handle, DBX_STATUS_ERROR, "can't create file %s/%s", out_dir, out_file);
+      goto WRITE_DONE;
+    }
+    dbx_stats_count(dbx->options->stats, DBX_COUNTER_FILES_CREATED, 1);
+  }
+
+  if (dbx->options->recover)
+    _recover(dbx, NULL, writer, eml_name, out_path? out_path : "standard output", saved, errors);
+  else
+    _export(dbx, writer, eml_name, out_path? out_path : "standard output", saved, errors);
+
+  rc = 0;
+  if (writer != stream) {
+    rc = dbx_writer_close(writer);
+    if (rc != 0) {
+      perror("_write_stream (fflush)");
+      dbx_progress_message(dbx->progress_handle, DBX_STATUS_ERROR, "can't write file %s", out_path);
+    }
+  }
+
+ WRITE_DONE:
+  if (file)
+    fclose(file);
+  free(out_path);
+  free(out_file);
+  return rc;
+}
+
+/* stats, if not NULL, are kept for this dbx file alone */
+static int _undbx(char *dbx_dir, char *out_dir, char *dbx_file, dbx_writer_t stream,
+                  dbx_options_t *shared_options, dbx_stats_t *stats)
 {
   int deleted = 0; 
   int saved = 0;
   int errors = 0;
+  dbx_options_t file_options = *shared_options;
+  dbx_options_t *options = &file_options;
+  double start = dbx_stats_clock(stats);
   
   dbx_t *dbx = NULL;
-  char *eml_dir = NULL;
-  char *cwd = NULL;
+  char *dbx_path = NULL;
+  char *eml_name = NULL;
+  char *eml_path = NULL;
+  sys_dir_t eml_dir = NULL;
+  dbx_manifest_t stamp = { 0 };
+  int message_count = 0;
   int rc = -1;
 
-  cwd = sys_getcwd();
-  if (cwd == NULL) {
-    dbx_progress_message(NULL, DBX_STATUS_ERROR, "can't get current working directory");
+  options->stats = stats;
+  dbx_path = sys_path(dbx_dir, dbx_file);
+  if (dbx_path == NULL) {
+    dbx_progress_message(NULL, DBX_STATUS_ERROR, "can't open DBX file %s", dbx_file);
     goto UNDBX_DONE;
   }
 
-  rc = sys_chdir(dbx_dir);
-  if (rc != 0) {
-    dbx_progress_message(NULL, DBX_STATUS_ERROR, "can't chdir to %s", dbx_dir);
+  eml_name = strdup(dbx_file);
+  eml_name[strlen(eml_name) - 4] = '\0';
+  eml_path = sys_path(out_dir, eml_name);
+
+  /* taken before the file is read, so any later change is noticed */
+  if (!options->recover && options->format == DBX_FORMAT_EML)
+    _stamp_manifest(&stamp, dbx_dir, dbx_file, options);
+
+  if (!options->recover && options->format == DBX_FORMAT_EML &&
+      eml_path && _unchanged(&stamp, eml_path, &message_count)) {
+    dbx_progress_handle_t progress = dbx_progress_new(options->verbosity);
+    dbx_progress_set_buffered(progress, options->jobs > 1);
+    dbx_progress_set_name(progress, dbx_path);
+    dbx_progress_push(progress,
+                      DBX_VERBOSITY_INFO,
+                      message_count,
+                      "Extracting %d messages from %s to %s",
+                      message_count,
+                      dbx_path,
+                      eml_path);
+    dbx_progress_pop(progress, "%d messages skipped, DBX file not modified", message_count);
+    dbx_progress_delete(progress);
+    dbx_stats_count(stats, DBX_COUNTER_MESSAGES_SKIPPED, message_count);
+    rc = 0;
     goto UNDBX_DONE;
   }
   
-  dbx = dbx_open(dbx_file, options);
+  dbx = dbx_open(dbx_path, options);
   
-  sys_chdir(cwd);
-
   if (dbx == NULL) {
     dbx_progress_message(NULL, DBX_STATUS_WARNING, "can't open DBX file %s", dbx_file);
     rc = -1;
@@ -423,36 +785,86 @@ static int _undbx(char *dbx_dir, char *out_dir, char *dbx_file, dbx_options_t *o
     dbx_progress_message(dbx->progress_handle, DBX_STATUS_WARNING,"DBX file %s is corrupted (larger than 2GB)", dbx_file);
   }
 
-  eml_dir = strdup(dbx_file);
-  eml_dir[strlen(eml_dir) - 4] = '\0';
-  rc = sys_mkdir(out_dir, eml_dir);
-  if (rc != 0) {
-    dbx_progress_message(dbx->progress_handle, DBX_STATUS_ERROR, "can't create directory %s/%s", out_dir, eml_dir);
+  if (options->format != DBX_FORMAT_EML) {
+    rc = _write_stream(dbx, out_dir, eml_name, stream, &saved, &errors);
     goto UNDBX_DONE;
   }
 
-  rc = sys_chdir(out_dir);
+  rc = sys_mkdir(out_dir, eml_name);
   if (rc != 0) {
-    dbx_progress_message(dbx->progress_handle, DBX_STATUS_ERROR, "can't chdir to %s", out_dir);
+    dbx_progress_message(dbx->progress_handle, DBX_STATUS_ERROR, "can't create directory %s/%s", out_dir, eml_name);
+    goto UNDBX_DONE;
+  }
+
+  /* all output files are accessed relative to this directory */
+  if (eml_path)
+    eml_dir = sys_dir_open(NULL, eml_path);
+  if (eml_dir == NULL) {
+    dbx_progress_message(dbx->progress_handle, DBX_STATUS_ERROR, "can't open directory %s/%s", out_dir, eml_name);
+    rc = -1;
     goto UNDBX_DONE;
   }
 
   if (options->recover)
-    _recover(dbx, out_dir, eml_dir, &saved, &errors);
+    _recover(dbx, eml_dir, NULL, NULL, sys_dir_name(eml_dir), &saved, &errors);
   else
-    _extract(dbx, out_dir, eml_dir, &saved, &deleted, &errors);
+    _extract(dbx, eml_dir, &stamp, &saved, &deleted, &errors);
 
  UNDBX_DONE:  
-  free(eml_dir);
+  sys_dir_close(eml_dir);
   eml_dir = NULL;
+  free(eml_path);
+  eml_path = NULL;
+  free(eml_name);
+  eml_name = NULL;
   dbx_close(dbx);
-  sys_chdir(cwd);
-  free(cwd);
-  cwd = NULL;
+  free(dbx_path);
+  dbx_path = NULL;
+  dbx_stats_elapsed(stats, start);
 
   return rc;
 }
 
+typedef struct {
+  char *dbx_dir;
+  char *out_dir;
+  char **dbx_files;
+  dbx_writer_t stream;
+  dbx_options_t *options;
+  dbx_stats_t **stats;
+  int *rc;
+} undbx_jobs_t;
+
+static void _undbx_job(void *arg, int n)
+{
+  undbx_jobs_t *jobs = (undbx_jobs_t *)arg;
+  jobs->rc[n] = _undbx(jobs->dbx_dir, jobs->out_dir, jobs->dbx_files[n], jobs->stream, jobs->options,
+                       jobs->stats? jobs->stats[n] : NULL);
+}
+
+/* per file and total statistics, as JSON */
+static void _write_stats(char *stats_file, dbx_stats_t **stats, int count, double start)
+{
+  dbx_stats_t *total = dbx_stats_new(NULL);
+  FILE *file = NULL;
+  int n = 0;
+
+  if (total == NULL)
+    return;
+
+  for (n = 0; n < count; n++)
+    dbx_stats_add(total, stats[n]);
+  dbx_stats_elapsed(total, start);
+
+  file = fopen(stats_file, "w");
+  if (file == NULL || dbx_stats_write_json(file, stats, count, total) != 0)
+    dbx_progress_message(NULL, DBX_STATUS_ERROR, "can't write statistics to %s", stats_file);
+  if (file)
+    fclose(file);
+
+  dbx_stats_free(total);
+}
+
 static char **_get_files(char **dir, int *num_files)
 {
   char **files = NULL;
@@ -473,12 +885,18 @@ static char **_get_files(char **dir, int *num_files)
 }
 
 
+static void _banner(void)
+{
+  dbx_progress_message(NULL, DBX_STATUS_OK, "UnDBX v" DBX_VERSION " (" __DATE__ ")");
+}
+
 static void _usage(char *prog, int rc)
 {
   FILE *stream = (rc == EXIT_SUCCESS)? stdout:stderr;
-  
+
+  _banner();
   fprintf(stream,
-          "Usage: %s [<OPTION>] <DBX-FOLDER | DBX-FILE> [<OUTPUT-FOLDER>]\n"
+          "Usage: %s [<OPTION>] <DBX-FOLDER | DBX-FILE> [<OUTPUT-FOLDER> | -]\n"
           "\n"
           "Options:\n"
           "\t-h, --help        \t show this message\n"
@@ -491,6 +909,26 @@ static void _usage(char *prog, int rc)
           "\t                  \t [default behavior is to move such messages to\n"
           "\t                  \t  a sub-directory named 'deleted']\n"
           "\t-i, --ignore0     \t ignore empty messages\n"
+          "\t-j, --jobs N      \t extract up to N DBX files in parallel\n"
+          "\t                  \t [default: 1]\n"
+          "\t-t, --threads N   \t extract messages of each DBX file, or scan\n"
+          "\t                  \t it in recovery mode, using N threads\n"
+          "\t                  \t [default: 1]\n"
+          "\t-x, --direct-io   \t bypass the OS file cache when scanning\n"
+          "\t                  \t in recovery mode\n"
+          "\t-f, --format FMT  \t save messages as separate 'eml' files, or\n"
+          "\t                  \t write them to a single 'mbox' or 'tar' file\n"
+          "\t                  \t per DBX file, or to standard output if the\n"
+          "\t                  \t output folder is '-' [default: eml]\n"
+          "\t-S, --stats FILE  \t write per-phase timings and I/O counters\n"
+          "\t                  \t of each DBX file, and totals, to FILE as\n"
+          "\t                  \t JSON\n"
+          "\t-p, --progress FMT\t report progress as 'text', or as 'jsonl'\n"
+          "\t                  \t events, one JSON object per line\n"
+          "\t                  \t [default: text]\n"
+          "\t-F, --progress-fd N\t write progress events to file descriptor N\n"
+          "\t                  \t [default: 1, or 2 if the output folder\n"
+          "\t                  \t  is '-']\n"
           "\t-d, --debug       \t output debug messages\n",
           prog);
   
@@ -499,6 +937,8 @@ static void _usage(char *prog, int rc)
 
 #ifdef _WIN32
 #include <windows.h>
+#include <io.h>
+#include <fcntl.h>
 static void _gui(char *prog)
 {
   FILE *rfp = NULL;
@@ -529,13 +969,20 @@ int main(int argc, char *argv[])
   char *out_dir = NULL;
   int num_dbx_files = 0;
   dbx_options_t options = { 0 };
+  dbx_writer_t stream = NULL;
+  char *stats_file = NULL;
+  int jsonl = 0;
+  int progress_fd = -1;
+  double start = sys_clock();
   int c = -1;
 
-  printf("UnDBX v" DBX_VERSION " (" __DATE__ ")\n");
-  fflush(stdout);
+  /* standard output may be taken by the messages themselves */
+  if (argc > 2 && strcmp(argv[argc - 1], "-") == 0)
+    dbx_progress_set_output(stderr);
 
   if (argc == 1) {
 #ifdef _WIN32
+    _banner();
     _gui(argv[0]);
 #else
     _usage(argv[0], EXIT_SUCCESS);
@@ -543,6 +990,8 @@ int main(int argc, char *argv[])
   }
 
   options.verbosity = DBX_VERBOSITY_INFO;
+  options.jobs = 1;
+  options.threads = 1;
   
   while (1) {
     static struct option long_options[] = {
@@ -553,11 +1002,18 @@ int main(int argc, char *argv[])
       {"safe-mode", no_argument, NULL, 's'},
       {"delete", no_argument, NULL, 'D'},
       {"ignore0", no_argument, NULL, 'i'},
+      {"jobs", required_argument, NULL, 'j'},
+      {"threads", required_argument, NULL, 't'},
+      {"direct-io", no_argument, NULL, 'x'},
+      {"format", required_argument, NULL, 'f'},
+      {"stats", required_argument, NULL, 'S'},
+      {"progress", required_argument, NULL, 'p'},
+      {"progress-fd", required_argument, NULL, 'F'},
       {"debug", no_argument, NULL, 'd'},
       {0, 0, 0, 0}
     };
     
-    c = getopt_long(argc, argv, "hVv:rsDid", long_options, NULL);
+    c = getopt_long(argc, argv, "hVv:rsDij:t:xf:S:p:F:d", long_options, NULL);
     if (c == -1 || c == '?' || c == ':')
       break;
     
@@ -566,6 +1022,7 @@ int main(int argc, char *argv[])
       _usage(argv[0], EXIT_SUCCESS);
       break;
     case 'V':
+      _banner();
       exit(EXIT_SUCCESS);
       break;
     case 'v':
@@ -583,6 +1040,55 @@ int main(int argc, char *argv[])
     case 'i':
       options.ignore0 = 1;
       break;
+    case 'j':
+      options.jobs = atoi(optarg);
+      if (options.jobs < 1) {
+        fprintf(stderr, "error: bad number of jobs\n");
+        _usage(argv[0], EXIT_FAILURE);
+      }
+      break;
+    case 't':
+      options.threads = atoi(optarg);
+      if (options.threads < 1) {
+        fprintf(stderr, "error: bad number of threads\n");
+        _usage(argv[0], EXIT_FAILURE);
+      }
+      break;
+    case 'x':
+      options.direct_io = 1;
+      break;
+    case 'f':
+      if (strcmp(optarg, "eml") == 0)
+        options.format = DBX_FORMAT_EML;
+      else if (strcmp(optarg, "mbox") == 0)
+        options.format = DBX_FORMAT_MBOX;
+      else if (strcmp(optarg, "tar") == 0)
+        options.format = DBX_FORMAT_TAR;
+      else {
+        fprintf(stderr, "error: bad output format\n");
+        _usage(argv[0], EXIT_FAILURE);
+      }
+      break;
+    case 'S':
+      stats_file = optarg;
+      break;
+    case 'p':
+      if (strcmp(optarg, "text") == 0)
+        jsonl = 0;
+      else if (strcmp(optarg, "jsonl") == 0)
+        jsonl = 1;
+      else {
+        fprintf(stderr, "error: bad progress format\n");
+        _usage(argv[0], EXIT_FAILURE);
+      }
+      break;
+    case 'F':
+      progress_fd = atoi(optarg);
+      if (progress_fd < 1) {
+        fprintf(stderr, "error: bad progress file descriptor\n");
+        _usage(argv[0], EXIT_FAILURE);
+      }
+      break;
     case 'd':
       options.debug = 1;
       break;
@@ -606,10 +1112,78 @@ int main(int argc, char *argv[])
   else
     out_dir = ".";
 
+  if (strcmp(out_dir, "-") == 0) {
+    if (options.format == DBX_FORMAT_EML) {
+      fprintf(stderr, "error: writing to standard output requires --format mbox or tar\n");
+      _usage(argv[0], EXIT_FAILURE);
+    }
+    if (jsonl && progress_fd == 1) {
+      fprintf(stderr, "error: standard output is taken by the messages\n");
+      _usage(argv[0], EXIT_FAILURE);
+    }
+#ifdef _WIN32
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    stream = dbx_writer_new(stdout, options.format);
+    if (stream == NULL)
+      exit(EXIT_FAILURE);
+  }
+
+  if (jsonl) {
+    FILE *events = NULL;
+    if (progress_fd < 0)
+      progress_fd = stream? 2 : 1;
+    if (progress_fd == 1)
+      events = stdout;
+    else if (progress_fd == 2)
+      events = stderr;
+    else
+      events = sys_fdopen(progress_fd, "w");
+    if (events == NULL) {
+      perror("main (fdopen)");
+      exit(EXIT_FAILURE);
+    }
+    dbx_progress_set_events(events);
+  }
+
+  _banner();
+
   dbx_files = _get_files(&dbx_dir, &num_dbx_files);
-  for(n = 0; n < num_dbx_files; n++) {
-    if (_undbx(dbx_dir, out_dir, dbx_files[n], &options))
-      fail++;
+  if (num_dbx_files > 0) {
+    undbx_jobs_t jobs;
+    jobs.dbx_dir = dbx_dir;
+    jobs.out_dir = out_dir;
+    jobs.dbx_files = dbx_files;
+    jobs.stream = stream;
+    jobs.options = &options;
+    jobs.stats = NULL;
+    jobs.rc = (int *)calloc(num_dbx_files, sizeof(int));
+    if (jobs.rc == NULL) {
+      perror("main (calloc)");
+      exit(EXIT_FAILURE);
+    }
+    if (stats_file) {
+      jobs.stats = (dbx_stats_t **)calloc(num_dbx_files, sizeof(dbx_stats_t *));
+      for(n = 0; jobs.stats && n < num_dbx_files; n++)
+        jobs.stats[n] = dbx_stats_new(dbx_files[n]);
+    }
+    sys_parallel(options.jobs, num_dbx_files, _undbx_job, &jobs);
+    for(n = 0; n < num_dbx_files; n++) {
+      if (jobs.rc[n])
+        fail++;
+    }
+    if (jobs.stats) {
+      _write_stats(stats_file, jobs.stats, num_dbx_files, start);
+      for(n = 0; n < num_dbx_files; n++)
+        dbx_stats_free(jobs.stats[n]);
+      free(jobs.stats);
+    }
+    free(jobs.rc);
+  }
+
+  if (stream && dbx_writer_close(stream) != 0) {
+    perror("main (fflush)");
+    fail = n;
   }
 
   if (num_dbx_files > 0)